@@ -0,0 +1,211 @@
+#include "CpuBodyTypes.h"
+#include <cmath>
+
+/** @brief Inverts a 3x3 matrix. Returns false if the matrix is singular
+*/
+static bool invertMatrix(float const * m, float * out)
+{
+	float det = m[0] * (m[4] * m[8] - m[7] * m[5])
+		- m[3] * (m[1] * m[8] - m[7] * m[2])
+		+ m[6] * (m[1] * m[5] - m[4] * m[2]);
+
+	if (det == 0.f) return false;
+
+	float invDet = 1.f / det;
+
+	out[0] = (m[4] * m[8] - m[7] * m[5]) * invDet;
+	out[1] = -(m[1] * m[8] - m[7] * m[2]) * invDet;
+	out[2] = (m[1] * m[5] - m[4] * m[2]) * invDet;
+	out[3] = -(m[3] * m[8] - m[6] * m[5]) * invDet;
+	out[4] = (m[0] * m[8] - m[6] * m[2]) * invDet;
+	out[5] = -(m[0] * m[5] - m[3] * m[2]) * invDet;
+	out[6] = (m[3] * m[7] - m[6] * m[4]) * invDet;
+	out[7] = -(m[0] * m[7] - m[6] * m[1]) * invDet;
+	out[8] = (m[0] * m[4] - m[3] * m[1]) * invDet;
+
+	return true;
+}
+
+CpuBodyTypes::CpuBodyTypes()
+{
+}
+
+
+CpuBodyTypes::~CpuBodyTypes()
+{
+}
+
+/** @brief Removes all types, the spawn sequence and the layout
+*/
+void CpuBodyTypes::clear(void)
+{
+	types.clear();
+	for (int c = 0; c < 3; c++) templates[c].resize(0);
+	spawnTypes.clear();
+
+	bodyTypes.clear();
+	bodyParticleOffsets.clear();
+	particleBodies.clear();
+}
+
+/**
+* @brief Appends a body type and returns its index, -1 if the template is empty
+* @param particlePositions	numParticles * 3 positions relative to the center of mass (see SolverModel::getParticlePositions())
+* @param numParticles		Number of particles of one body of this type
+* @param inertiaTensor		Column major 3x3 inertia tensor
+* @param mass				Mass of one body, 0 follows the mass of the solver parameters
+*/
+int CpuBodyTypes::addType(float const * particlePositions, int numParticles, float const * inertiaTensor, float mass)
+{
+	if (numParticles <= 0 || particlePositions == NULL) return -1;
+
+	BodyType type;
+	type.firstParticle = int(templates[0].size());
+	type.numParticles = numParticles;
+	type.mass = mass;
+	type.radius = 0.f;
+
+	for (int c = 0; c < 3; c++) {
+		templates[c].resize(type.firstParticle + numParticles);
+		for (int particle = 0; particle < numParticles; particle++) templates[c][type.firstParticle + particle] = particlePositions[particle * 3 + c];
+	}
+
+	for (int particle = 0; particle < numParticles; particle++) {
+		float const * position = &particlePositions[particle * 3];
+		type.radius = std::max(type.radius, std::sqrt(position[0] * position[0] + position[1] * position[1] + position[2] * position[2]));
+	}
+
+	if (inertiaTensor == NULL || !invertMatrix(inertiaTensor, type.invInertiaTensor)) {
+		std::fill(type.invInertiaTensor, type.invInertiaTensor + 9, 0.f);
+	}
+
+	types.push_back(type);
+	return int(types.size()) - 1;
+}
+
+/**
+* @brief Appends a body type whose radius and inverse inertia tensor are known, e.g. from a checkpoint, and returns its index.
+* The template streams hold type.numParticles positions each, type.firstParticle is ignored
+*/
+int CpuBodyTypes::restoreType(BodyType const & type, float const * templateX, float const * templateY, float const * templateZ)
+{
+	if (type.numParticles <= 0) return -1;
+
+	float const * streams[3] = { templateX, templateY, templateZ };
+
+	BodyType restored = type;
+	restored.firstParticle = int(templates[0].size());
+
+	for (int c = 0; c < 3; c++) {
+		templates[c].resize(restored.firstParticle + type.numParticles);
+		std::copy(streams[c], streams[c] + type.numParticles, templates[c].data() + restored.firstParticle);
+	}
+
+	types.push_back(restored);
+	return int(types.size()) - 1;
+}
+
+/**
+* @brief Sets the types of the spawned bodies: spawn s gets the type types[s % types.size()]. An empty sequence cycles through
+* all types. Returns false if the sequence names an unknown type
+*/
+bool CpuBodyTypes::setSpawnTypes(std::vector<int> const & types)
+{
+	for (size_t i = 0; i < types.size(); i++) {
+		if (types[i] < 0 || types[i] >= getNumTypes()) return false;
+	}
+
+	spawnTypes = types;
+	return true;
+}
+
+/**
+* @brief Lays out the particles of the bodies 0 to numBodies - 1 one body after the other. Bodies of the last layout keep their
+* type, body b of the others gets the type of spawn b. layout(0) forgets all types
+*/
+void CpuBodyTypes::layout(int numBodies)
+{
+	int numTypes = getNumTypes();
+	int first = std::min(int(bodyTypes.size()), numBodies);
+
+	bodyTypes.resize(numBodies);
+	for (int body = first; body < numBodies; body++) bodyTypes[body] = getSpawnType(unsigned(body));
+
+	bodyParticleOffsets.resize(numBodies + 1);
+	bodyParticleOffsets[0] = 0u;
+
+	for (int body = 0; body < numBodies; body++) {
+		bodyParticleOffsets[body + 1] = bodyParticleOffsets[body] + (numTypes > 0 ? unsigned(types[bodyTypes[body]].numParticles) : 0u);
+	}
+
+	particleBodies.resize(bodyParticleOffsets[numBodies]);
+	for (int body = 0; body < numBodies; body++) {
+		std::fill(particleBodies.begin() + bodyParticleOffsets[body], particleBodies.begin() + bodyParticleOffsets[body + 1], unsigned(body));
+	}
+}
+
+/**
+* @brief Changes the type of a body of the layout, e.g. when another body moves into its place. The particle ranges are updated by
+* the next layout() call
+*/
+void CpuBodyTypes::setBodyType(int body, unsigned int type)
+{
+	bodyTypes[body] = type;
+}
+
+/** @brief Returns the number of body types
+*/
+int CpuBodyTypes::getNumTypes(void) const
+{
+	return int(types.size());
+}
+
+/** @brief Returns the given body type
+*/
+BodyType const & CpuBodyTypes::getType(int type) const
+{
+	return types[type];
+}
+
+/** @brief Returns the x, y or z stream of the concatenated particle templates
+*/
+float const * CpuBodyTypes::getTemplate(int component) const
+{
+	return templates[component].data();
+}
+
+/** @brief Returns the spawn sequence, empty if the bodies cycle through all types
+*/
+std::vector<int> const & CpuBodyTypes::getSpawnTypes(void) const
+{
+	return spawnTypes;
+}
+
+/** @brief Returns the type of the given spawn of the spawn sequence
+*/
+unsigned int CpuBodyTypes::getSpawnType(unsigned int spawn) const
+{
+	if (!spawnTypes.empty()) return unsigned(spawnTypes[spawn % spawnTypes.size()]);
+	return types.empty() ? 0u : spawn % unsigned(types.size());
+}
+
+/** @brief Returns the type of every body of the layout
+*/
+std::vector<unsigned int> const & CpuBodyTypes::getBodyTypes(void) const
+{
+	return bodyTypes;
+}
+
+/** @brief Returns the id of the first particle of every body of the layout and the number of particles as last entry
+*/
+std::vector<unsigned int> const & CpuBodyTypes::getBodyParticleOffsets(void) const
+{
+	return bodyParticleOffsets;
+}
+
+/** @brief Returns the body of every particle id of the layout
+*/
+std::vector<unsigned int> const & CpuBodyTypes::getParticleBodies(void) const
+{
+	return particleBodies;
+}
@@ -0,0 +1,51 @@
+#pragma once
+#include <vector>
+#include "CpuSolverState.h"
+
+// Particle template, mass and inertia of one kind of rigid body
+struct BodyType {
+	int firstParticle; // Offset of the template in the template streams
+	int numParticles;
+	float mass; // Mass of one body, 0 takes the mass of the solver parameters
+	float radius; // Largest distance of a particle to the center of mass
+	float invInertiaTensor[9]; // Column major, zero if the inertia tensor is singular
+};
+
+// Table of the body types and the particle layout of the bodies. The templates of all types are concatenated into one set of
+// streams. The particles of body b have the ids getBodyParticleOffsets()[b] to getBodyParticleOffsets()[b + 1] - 1
+// (compressed sparse rows), so the passes run over the bodies of all types at once
+class CpuBodyTypes
+{
+public:
+	CpuBodyTypes();
+	~CpuBodyTypes();
+
+	void clear(void);
+	int addType(float const * particlePositions, int numParticles, float const * inertiaTensor, float mass);
+	int restoreType(BodyType const & type, float const * templateX, float const * templateY, float const * templateZ);
+	bool setSpawnTypes(std::vector<int> const & types);
+	void layout(int numBodies);
+	void setBodyType(int body, unsigned int type);
+
+	int getNumTypes(void) const;
+	BodyType const & getType(int type) const;
+	float const * getTemplate(int component) const;
+	std::vector<int> const & getSpawnTypes(void) const;
+	unsigned int getSpawnType(unsigned int spawn) const;
+
+	std::vector<unsigned int> const & getBodyTypes(void) const;
+	std::vector<unsigned int> const & getBodyParticleOffsets(void) const;
+	std::vector<unsigned int> const & getParticleBodies(void) const;
+
+private:
+
+	std::vector<BodyType> types;
+	AlignedArray<float> templates[3]; // Positions relative to the center of mass
+	std::vector<int> spawnTypes; // Type of spawn s is spawnTypes[s % size], empty cycles through all types
+
+	// Layout of the bodies of the last layout() call
+	std::vector<unsigned int> bodyTypes;
+	std::vector<unsigned int> bodyParticleOffsets;
+	std::vector<unsigned int> particleBodies;
+
+};
@@ -0,0 +1,91 @@
+#include "CpuBroadPhase.h"
+
+CpuBroadPhase::CpuBroadPhase()
+{
+}
+
+
+CpuBroadPhase::~CpuBroadPhase()
+{
+}
+
+/** @brief Forgets the order of the last update
+*/
+void CpuBroadPhase::clear(void)
+{
+	order.clear();
+	pairs.clear();
+	activeBodies.clear();
+}
+
+/**
+* @brief Finds the pairs of rigid bodies whose bounding boxes overlap
+* @param positionX, positionY, positionZ	Centers of mass of the rigid bodies
+* @param extents						Half edge length of the box of each body. A negative infinite extent gives an empty box which
+*										overlaps nothing, e.g. for despawned bodies
+* @param numBodies						Number of rigid bodies - bodies added since the last update are appended
+*/
+void CpuBroadPhase::update(float const * positionX, float const * positionY, float const * positionZ, float const * extents, int numBodies)
+{
+	float const * positions[3] = { positionX, positionY, positionZ };
+
+	for (int axis = 0; axis < 3; axis++) {
+		lowerBounds[axis].resize(numBodies);
+		upperBounds[axis].resize(numBodies);
+
+		for (int body = 0; body < numBodies; body++) {
+			lowerBounds[axis][body] = positions[axis][body] - extents[body];
+			upperBounds[axis][body] = positions[axis][body] + extents[body];
+		}
+	}
+
+	if (int(order.size()) > numBodies) order.clear();
+	for (unsigned int body = unsigned(order.size()); body < unsigned(numBodies); body++) order.push_back(body);
+
+	// Insertion sort - nearly linear as the bodies barely move between two updates
+	std::vector<float> const & lowerX = lowerBounds[0];
+	for (size_t i = 1; i < order.size(); i++) {
+		unsigned int body = order[i];
+		size_t j = i;
+		while (j > 0 && lowerX[order[j - 1]] > lowerX[body]) {
+			order[j] = order[j - 1];
+			j--;
+		}
+		order[j] = body;
+	}
+
+	// Sweep along x, the boxes overlapping on x are tested on y and z
+	pairs.clear();
+	activeBodies.assign(numBodies, 0);
+
+	for (size_t i = 0; i < order.size(); i++) {
+
+		unsigned int a = order[i];
+
+		for (size_t j = i + 1; j < order.size() && lowerX[order[j]] <= upperBounds[0][a]; j++) {
+
+			unsigned int b = order[j];
+
+			if (lowerBounds[1][a] > upperBounds[1][b] || lowerBounds[1][b] > upperBounds[1][a]) continue;
+			if (lowerBounds[2][a] > upperBounds[2][b] || lowerBounds[2][b] > upperBounds[2][a]) continue;
+
+			pairs.push_back(a < b ? BodyPair(a, b) : BodyPair(b, a));
+			activeBodies[a] = 1;
+			activeBodies[b] = 1;
+		}
+	}
+}
+
+/** @brief Returns the pairs of overlapping bodies found by the last update
+*/
+std::vector<BodyPair> const & CpuBroadPhase::getPairs(void) const
+{
+	return pairs;
+}
+
+/** @brief Returns 1 for every body which overlaps at least one other body
+*/
+std::vector<unsigned char> const & CpuBroadPhase::getActiveBodies(void) const
+{
+	return activeBodies;
+}
@@ -0,0 +1,34 @@
+#pragma once
+#include <cstddef>
+#include <utility>
+#include <vector>
+
+// Pair of rigid body indices, first < second
+typedef std::pair<unsigned int, unsigned int> BodyPair;
+
+// Sweep and prune over the axis aligned bounding boxes of the rigid bodies. The bodies stay sorted along x between two
+// updates, so the insertion sort of the next update only has to move the few bodies which overtook each other
+class CpuBroadPhase
+{
+public:
+	CpuBroadPhase();
+	~CpuBroadPhase();
+
+	void clear(void);
+	void update(float const * positionX, float const * positionY, float const * positionZ, float const * extents, int numBodies);
+
+	std::vector<BodyPair> const & getPairs(void) const;
+	std::vector<unsigned char> const & getActiveBodies(void) const;
+
+private:
+
+	// Bodies sorted by the lower bound of their box along x - kept from the last update
+	std::vector<unsigned int> order;
+
+	std::vector<float> lowerBounds[3];
+	std::vector<float> upperBounds[3];
+
+	std::vector<BodyPair> pairs;
+	std::vector<unsigned char> activeBodies; // 1 if the box of the body overlaps another one
+
+};
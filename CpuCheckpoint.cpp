@@ -0,0 +1,342 @@
+#include "CpuCheckpoint.h"
+#include <cstring>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+#include <algorithm>
+
+// Headers of the file and of each section take one cache line each, so the elements start at multiples of 64 bytes
+static const size_t CHECKPOINT_ALIGNMENT = 64;
+static const char CHECKPOINT_MAGIC[8] = { 'R', 'S', 'O', 'L', 'V', 'C', 'K', 'P' };
+
+// Written as a number, read back in another byte order it does not match
+static const unsigned int CHECKPOINT_BYTE_ORDER = 0x01020304u;
+
+struct CheckpointFileHeader {
+	char magic[8];
+	unsigned int version;
+	unsigned int byteOrder;
+	unsigned int reserved[12];
+};
+
+struct CheckpointSectionHeader {
+	unsigned int id;
+	unsigned int elementSize;
+	unsigned int count[2]; // Low and high half
+	unsigned int reserved[12];
+};
+
+static_assert(sizeof(CheckpointFileHeader) == CHECKPOINT_ALIGNMENT, "The file header has to fill one cache line");
+static_assert(sizeof(CheckpointSectionHeader) == CHECKPOINT_ALIGNMENT, "The section header has to fill one cache line");
+
+// --------------------------------------------------
+//  Mapped file
+// --------------------------------------------------
+
+MappedFile::MappedFile()
+{
+}
+
+
+MappedFile::~MappedFile()
+{
+	close();
+}
+
+/**
+* @brief Maps the whole file read only. Returns false if it can not be opened, is empty or can not be mapped
+* @param readAhead	Starts reading the whole file right away, e.g. for a checkpoint. Large files which are read in parts
+*					fetch these parts with prefetch() instead
+*/
+bool MappedFile::open(std::string const & path, bool readAhead)
+{
+	close();
+
+#ifdef _WIN32
+	DWORD flags = FILE_ATTRIBUTE_NORMAL | (readAhead ? FILE_FLAG_SEQUENTIAL_SCAN : 0);
+	file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, flags, NULL);
+	if (file == INVALID_HANDLE_VALUE) {
+		file = NULL;
+		return false;
+	}
+
+	LARGE_INTEGER fileSize;
+	if (!GetFileSizeEx(file, &fileSize) || fileSize.QuadPart == 0) {
+		close();
+		return false;
+	}
+
+	fileMapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+	if (fileMapping == NULL) {
+		close();
+		return false;
+	}
+
+	mapping = static_cast<unsigned char const *>(MapViewOfFile(fileMapping, FILE_MAP_READ, 0, 0, 0));
+	if (mapping == NULL) {
+		close();
+		return false;
+	}
+
+	bytes = size_t(fileSize.QuadPart);
+#else
+	int descriptor = ::open(path.c_str(), O_RDONLY);
+	if (descriptor < 0) return false;
+
+	struct stat status;
+	if (fstat(descriptor, &status) != 0 || status.st_size == 0) {
+		::close(descriptor);
+		return false;
+	}
+
+	void * view = mmap(NULL, size_t(status.st_size), PROT_READ, MAP_PRIVATE, descriptor, 0);
+
+	// The mapping keeps the file open
+	::close(descriptor);
+	if (view == MAP_FAILED) return false;
+
+	// The whole file is read right away - start reading it ahead of the copies
+	if (readAhead) madvise(view, size_t(status.st_size), MADV_WILLNEED);
+
+	mapping = static_cast<unsigned char const *>(view);
+	bytes = size_t(status.st_size);
+#endif
+
+	return true;
+}
+
+/** @brief Unmaps the file
+*/
+void MappedFile::close(void)
+{
+#ifdef _WIN32
+	if (mapping != NULL) UnmapViewOfFile(mapping);
+	if (fileMapping != NULL) CloseHandle(fileMapping);
+	if (file != NULL) CloseHandle(file);
+	fileMapping = NULL;
+	file = NULL;
+#else
+	if (mapping != NULL) munmap(const_cast<unsigned char *>(mapping), bytes);
+#endif
+
+	mapping = NULL;
+	bytes = 0;
+}
+
+/**
+* @brief Asks the operating system to read the given range of the file in the background, so the pages are resident by the time
+* they are touched. Ranges beyond the file are clipped
+*/
+void MappedFile::prefetch(size_t offset, size_t bytes) const
+{
+	if (mapping == NULL || offset >= this->bytes) return;
+	bytes = std::min(bytes, this->bytes - offset);
+
+#ifdef _WIN32
+#if _WIN32_WINNT >= 0x0602
+	WIN32_MEMORY_RANGE_ENTRY range;
+	range.VirtualAddress = const_cast<unsigned char *>(mapping + offset);
+	range.NumberOfBytes = bytes;
+	PrefetchVirtualMemory(GetCurrentProcess(), 1, &range, 0);
+#endif
+#else
+	// madvise() takes whole pages
+	size_t pageSize = size_t(sysconf(_SC_PAGESIZE));
+	size_t first = offset / pageSize * pageSize;
+	madvise(const_cast<unsigned char *>(mapping + first), offset + bytes - first, MADV_WILLNEED);
+#endif
+}
+
+/** @brief Returns the first byte of the mapping, NULL if no file is mapped
+*/
+unsigned char const * MappedFile::data(void) const
+{
+	return mapping;
+}
+
+/** @brief Returns the size of the mapped file in bytes
+*/
+size_t MappedFile::size(void) const
+{
+	return bytes;
+}
+
+// --------------------------------------------------
+//  Writer
+// --------------------------------------------------
+
+CheckpointWriter::CheckpointWriter()
+{
+}
+
+
+CheckpointWriter::~CheckpointWriter()
+{
+	if (file != NULL) std::fclose(file);
+}
+
+/**
+* @brief Creates the file and writes the file header
+*/
+bool CheckpointWriter::open(std::string const & path)
+{
+	if (file != NULL) std::fclose(file);
+
+	file = std::fopen(path.c_str(), "wb");
+	if (file == NULL) return false;
+
+	CheckpointFileHeader header;
+	std::memset(&header, 0, sizeof(header));
+	std::memcpy(header.magic, CHECKPOINT_MAGIC, sizeof(header.magic));
+	header.version = CHECKPOINT_VERSION;
+	header.byteOrder = CHECKPOINT_BYTE_ORDER;
+
+	failed = std::fwrite(&header, sizeof(header), 1, file) != 1;
+
+	return !failed;
+}
+
+/**
+* @brief Closes the file. Returns false if any write failed, the file is incomplete then
+*/
+bool CheckpointWriter::close(void)
+{
+	if (file == NULL) return false;
+
+	failed = std::fclose(file) != 0 || failed;
+	file = NULL;
+
+	return !failed;
+}
+
+/**
+* @brief Writes a section of count elements of elementSize bytes
+*/
+void CheckpointWriter::write(unsigned int id, void const * elements, size_t elementSize, size_t count)
+{
+	if (file == NULL || failed) return;
+
+	CheckpointSectionHeader header;
+	std::memset(&header, 0, sizeof(header));
+	header.id = id;
+	header.elementSize = unsigned(elementSize);
+	header.count[0] = unsigned(count & 0xFFFFFFFFu);
+	header.count[1] = unsigned((unsigned long long)(count) >> 32);
+
+	size_t bytes = elementSize * count;
+	size_t padding = (CHECKPOINT_ALIGNMENT - bytes % CHECKPOINT_ALIGNMENT) % CHECKPOINT_ALIGNMENT;
+	static const unsigned char zeros[CHECKPOINT_ALIGNMENT] = {};
+
+	failed = std::fwrite(&header, sizeof(header), 1, file) != 1
+		|| (bytes > 0 && std::fwrite(elements, bytes, 1, file) != 1)
+		|| (padding > 0 && std::fwrite(zeros, padding, 1, file) != 1);
+}
+
+// --------------------------------------------------
+//  Reader
+// --------------------------------------------------
+
+CheckpointReader::CheckpointReader()
+{
+}
+
+
+CheckpointReader::~CheckpointReader()
+{
+}
+
+/**
+* @brief Maps the checkpoint and indexes its sections. Returns false if it is no checkpoint, has another version or byte order or
+* is truncated
+*/
+bool CheckpointReader::open(std::string const & path)
+{
+	sections.clear();
+	if (!file.open(path)) return false;
+
+	unsigned char const * data = file.data();
+	size_t size = file.size();
+
+	CheckpointFileHeader header;
+	if (size < sizeof(header)) return false;
+	std::memcpy(&header, data, sizeof(header));
+
+	if (std::memcmp(header.magic, CHECKPOINT_MAGIC, sizeof(header.magic)) != 0) return false;
+	if (header.version != CHECKPOINT_VERSION || header.byteOrder != CHECKPOINT_BYTE_ORDER) return false;
+
+	size_t offset = sizeof(header);
+
+	while (offset < size) {
+
+		CheckpointSectionHeader sectionHeader;
+		if (size - offset < sizeof(sectionHeader)) return false;
+		std::memcpy(&sectionHeader, data + offset, sizeof(sectionHeader));
+		offset += sizeof(sectionHeader);
+
+		Section section;
+		section.id = sectionHeader.id;
+		section.elementSize = sectionHeader.elementSize;
+		section.count = size_t((unsigned long long)(sectionHeader.count[1]) << 32 | sectionHeader.count[0]);
+		section.elements = data + offset;
+
+		// Sections which end behind the file are truncated
+		if (section.elementSize > 0 && section.count > (size - offset) / section.elementSize) return false;
+
+		size_t bytes = size_t(section.elementSize) * section.count;
+		offset += bytes + (CHECKPOINT_ALIGNMENT - bytes % CHECKPOINT_ALIGNMENT) % CHECKPOINT_ALIGNMENT;
+
+		sections.push_back(section);
+	}
+
+	return true;
+}
+
+/**
+* @brief Tells whether the checkpoint has the section with count elements of elementSize bytes. A missing section counts as an empty
+* one, e.g. the voxels of a dense grid
+*/
+bool CheckpointReader::has(unsigned int id, size_t elementSize, size_t count) const
+{
+	Section const * section = find(id);
+	if (section == NULL) return count == 0;
+
+	return section->elementSize == elementSize && section->count == count;
+}
+
+/** @brief Returns the number of elements of the section, 0 if it is missing
+*/
+size_t CheckpointReader::count(unsigned int id) const
+{
+	Section const * section = find(id);
+	return section != NULL ? section->count : 0;
+}
+
+/**
+* @brief Copies the elements of the section out of the mapping. Returns false if its elements have another size or number
+* than expected - see has()
+*/
+bool CheckpointReader::read(unsigned int id, void * elements, size_t elementSize, size_t count) const
+{
+	if (!has(id, elementSize, count)) return false;
+
+	if (count > 0) std::memcpy(elements, find(id)->elements, elementSize * count);
+	return true;
+}
+
+/** @brief Returns the section with the given id, NULL if there is none
+*/
+CheckpointReader::Section const * CheckpointReader::find(unsigned int id) const
+{
+	for (size_t i = 0; i < sections.size(); i++) {
+		if (sections[i].id == id) return &sections[i];
+	}
+	return NULL;
+}
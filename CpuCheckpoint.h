@@ -0,0 +1,173 @@
+#pragma once
+#include <cstddef>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+// Version of the checkpoint format - readers reject other versions
+const unsigned int CHECKPOINT_VERSION = 1;
+
+// Most bodies a checkpoint may hold - the reader checks the capacity against it before it allocates anything
+const unsigned int CHECKPOINT_MAX_BODIES = 1u << 26;
+
+// Sections of a checkpoint. Every section is one array, so it is copied into its state stream in one go. Streams with
+// several components take consecutive ids, e.g. CheckpointPosition + ComponentY
+enum CheckpointSection {
+	CheckpointSolver = 1,				// CheckpointSolverState
+	CheckpointTypes = 2,				// CheckpointBodyType of each body type
+	CheckpointTemplate = 3,				// x, y and z stream of the concatenated templates (3 - 5)
+	CheckpointSpawnTypes = 6,			// Spawn sequence
+	CheckpointBodyTypes = 7,			// Type of each body the storage holds
+	CheckpointPosition = 8,				// Front buffer x, y, z and w (8 - 11)
+	CheckpointNextPosition = 12,		// Back buffer, the position of the last step (12 - 15)
+	CheckpointQuaternion = 16,			// (16 - 19)
+	CheckpointNextQuaternion = 20,		// (20 - 23)
+	CheckpointLinearMomentum = 24,		// (24 - 26)
+	CheckpointAngularMomentum = 27,		// (27 - 29)
+	CheckpointSleepStates = 30,
+	CheckpointRestingSteps = 31,
+	CheckpointBodyAges = 32,
+	CheckpointFreeBodyTypes = 33,		// Type and body of each entry of the free lists, in the order of the lists
+	CheckpointFreeBodies = 34,
+	CheckpointSlotParticles = 35,		// Particle id of each slot of the particle streams
+	CheckpointParticlePosition = 36,	// Particle positions of the last step by slot (36 - 38), sleeping bodies keep them
+	CheckpointParticleVelocity = 39,	// (39 - 41)
+	CheckpointParticleBody = 42,		// Body of each slot as of the last step
+	CheckpointCellStart = 43,			// Collision grid of the last step, the emitters place the next spawns with it
+	CheckpointCellParticles = 44,
+	CheckpointParticleVoxels = 45,		// Hashed grid only
+	CheckpointEmitters = 46				// CheckpointEmitter of each emitter
+};
+
+// Counters, time step state and grid parameters of the solver. All fields are 4 bytes wide, so the layout is the same for
+// every compiler
+struct CheckpointSolverState {
+	unsigned int spawnedObjects;
+	unsigned int capacity; // Bodies the storage holds, their types fix the particle ranges
+	unsigned int numSlots; // Slots of the particle streams in the checkpoint
+	unsigned int stepCount;
+	unsigned int spawnCount;
+	float timeSinceSpawn;
+	float accumulatedTime;
+	float lastDeltaT;
+	float nextTimeStep;
+	unsigned int stateChecksum[2]; // Low and high half
+	float btmLeftFrontCorner[3];
+	float topRightBackCorner[3];
+	float voxelLength;
+	float emitterPosition[3];
+	float particleDiameter;
+	int gridType;
+	int integrator;
+};
+
+// Body type without its template, which is stored in the template streams
+struct CheckpointBodyType {
+	int numParticles;
+	float mass;
+	float radius;
+	float invInertiaTensor[9];
+};
+
+// Settings of an emitter and the spawns it owes
+struct CheckpointEmitter {
+	float position[3];
+	float extent[3];
+	float rate;
+	float velocity[3];
+	float coneAngle;
+	float speedVariation;
+	int type;
+	unsigned int enabled;
+	unsigned int seed;
+	int rateSpawns;
+	float rateCredit;
+	int burstSpawns;
+	unsigned int random[2]; // Low and high half
+};
+
+// Read only memory mapping of a whole file
+class MappedFile
+{
+public:
+	MappedFile();
+	~MappedFile();
+
+	bool open(std::string const & path, bool readAhead = true);
+	void close(void);
+	void prefetch(size_t offset, size_t bytes) const;
+
+	unsigned char const * data(void) const;
+	size_t size(void) const;
+
+private:
+
+	MappedFile(const MappedFile &);
+	MappedFile & operator=(const MappedFile &);
+
+	unsigned char const * mapping = NULL;
+	size_t bytes = 0;
+
+#ifdef _WIN32
+	void * file = NULL; // HANDLEs of the file and the mapping
+	void * fileMapping = NULL;
+#endif
+
+};
+
+// Writes a checkpoint section by section. A section is a header - id, element size and count - followed by the elements, padded
+// to 64 bytes so the elements of every section are aligned like the state streams in the mapping
+class CheckpointWriter
+{
+public:
+	CheckpointWriter();
+	~CheckpointWriter();
+
+	bool open(std::string const & path);
+	bool close(void);
+
+	void write(unsigned int id, void const * elements, size_t elementSize, size_t count);
+
+	template <class T> void write(unsigned int id, T const * elements, size_t count) { write(id, elements, sizeof(T), count); }
+
+private:
+
+	CheckpointWriter(const CheckpointWriter &);
+	CheckpointWriter & operator=(const CheckpointWriter &);
+
+	std::FILE * file = NULL;
+	bool failed = false;
+
+};
+
+// Maps a checkpoint and finds its sections
+class CheckpointReader
+{
+public:
+	CheckpointReader();
+	~CheckpointReader();
+
+	bool open(std::string const & path);
+
+	bool has(unsigned int id, size_t elementSize, size_t count) const;
+	size_t count(unsigned int id) const;
+	bool read(unsigned int id, void * elements, size_t elementSize, size_t count) const;
+
+	template <class T> bool has(unsigned int id, size_t count) const { return has(id, sizeof(T), count); }
+	template <class T> bool read(unsigned int id, T * elements, size_t count) const { return read(id, elements, sizeof(T), count); }
+
+private:
+
+	struct Section {
+		unsigned int id;
+		unsigned int elementSize;
+		size_t count;
+		unsigned char const * elements;
+	};
+
+	Section const * find(unsigned int id) const;
+
+	MappedFile file;
+	std::vector<Section> sections;
+
+};
@@ -0,0 +1,399 @@
+#include "CpuContactKernel.h"
+#include <algorithm>
+#include <cmath>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define CONTACT_KERNEL_X86
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
+// GCC and Clang need the instruction set per function, MSVC emits the intrinsics as they are.
+// AVX-512 implies FMA and GCC would fuse the multiply-adds of the distance - particles touching at exactly one
+// diameter would then flip between colliding and not colliding compared to the scalar kernel
+#if defined(__clang__)
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#define TARGET_AVX512 __attribute__((target("avx512f")))
+#elif defined(__GNUC__)
+#define TARGET_AVX2 __attribute__((target("avx2"), optimize("fp-contract=off")))
+#define TARGET_AVX512 __attribute__((target("avx512f"), optimize("fp-contract=off")))
+#else
+#define TARGET_AVX2
+#define TARGET_AVX512
+#endif
+
+// --------------------------------------------------
+//  Scalar
+// --------------------------------------------------
+
+/**
+* @brief Reference implementation of the contact loop of collision.frag - one candidate at a time
+*/
+static void contactKernelScalar(ContactParticles const & particles, unsigned int particleID,
+	unsigned int const * candidates, int numCandidates, ContactParameters const & parameters, float * force, float * overlap)
+{
+	const float springCoefficient = parameters.springCoefficient;
+	const float dampingCoefficient = parameters.dampingCoefficient;
+	const float particleDiameter = parameters.particleDiameter;
+
+	float position_i[3] = { particles.positionX[particleID], particles.positionY[particleID], particles.positionZ[particleID] };
+	float velocity_i[3] = { particles.velocityX[particleID], particles.velocityY[particleID], particles.velocityZ[particleID] };
+
+	bool filterBodies = particles.body != NULL;
+	unsigned int body_i = filterBodies ? particles.body[particleID] : 0u;
+
+	for (int candidate = 0; candidate < numCandidates; candidate++) {
+
+		unsigned int particleIdx = candidates[candidate];
+
+		// Don't test on itself, on an empty id or on the own body
+		if (particleIdx == CONTACT_EMPTY_SLOT || particleIdx == particleID) continue;
+		if (filterBodies && particles.body[particleIdx] == body_i) continue;
+
+		float relativePosition[3] = {
+			std::abs(position_i[0] - particles.positionX[particleIdx]),
+			std::abs(position_i[1] - particles.positionY[particleIdx]),
+			std::abs(position_i[2] - particles.positionZ[particleIdx])
+		};
+		float velocity_ij[3] = {
+			velocity_i[0] - particles.velocityX[particleIdx],
+			velocity_i[1] - particles.velocityY[particleIdx],
+			velocity_i[2] - particles.velocityZ[particleIdx]
+		};
+
+		float particleDistance = std::sqrt(relativePosition[0] * relativePosition[0] + relativePosition[1] * relativePosition[1] + relativePosition[2] * relativePosition[2]);
+
+		// Coinciding particles have no direction - the shader would produce NaNs here
+		if (particleDistance >= particleDiameter || particleDistance <= 0.f) continue;
+
+		*overlap = std::max(*overlap, particleDiameter - particleDistance);
+
+		float springMagnitude = -1.f * springCoefficient * (dampingCoefficient - particleDistance);
+
+		for (int c = 0; c < 3; c++) {
+			float normal = relativePosition[c] / particleDistance;
+
+			float forceSpring = springMagnitude * normal;
+			float forceDamp = particleDiameter * velocity_ij[c];
+			float forceTangential = springCoefficient * (velocity_ij[c] - (velocity_ij[c] * normal) * normal);
+
+			force[c] += forceSpring + forceDamp + forceTangential;
+		}
+	}
+}
+
+#ifdef CONTACT_KERNEL_X86
+
+// --------------------------------------------------
+//  AVX2 - 8 candidates per instruction
+// --------------------------------------------------
+
+/** @brief Sums up the 8 lanes of the register
+*/
+TARGET_AVX2 static float horizontalSumAVX2(__m256 v)
+{
+	__m128 sum = _mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+	sum = _mm_add_ps(sum, _mm_movehl_ps(sum, sum));
+	sum = _mm_add_ss(sum, _mm_shuffle_ps(sum, sum, 1));
+	return _mm_cvtss_f32(sum);
+}
+
+/** @brief Returns the largest of the 8 lanes of the register
+*/
+TARGET_AVX2 static float horizontalMaxAVX2(__m256 v)
+{
+	__m128 max = _mm_max_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+	max = _mm_max_ps(max, _mm_movehl_ps(max, max));
+	max = _mm_max_ss(max, _mm_shuffle_ps(max, max, 1));
+	return _mm_cvtss_f32(max);
+}
+
+/**
+* @brief AVX2 implementation of the contact loop. Gathers 8 candidates per iteration, empty slots and the particle itself
+* are masked out and redirected to the particle itself so the gathers stay in bounds
+*/
+TARGET_AVX2 static void contactKernelAVX2(ContactParticles const & particles, unsigned int particleID,
+	unsigned int const * candidates, int numCandidates, ContactParameters const & parameters, float * force, float * overlap)
+{
+	const __m256 springCoefficient = _mm256_set1_ps(parameters.springCoefficient);
+	const __m256 negativeSpringCoefficient = _mm256_set1_ps(-1.f * parameters.springCoefficient);
+	const __m256 dampingCoefficient = _mm256_set1_ps(parameters.dampingCoefficient);
+	const __m256 particleDiameter = _mm256_set1_ps(parameters.particleDiameter);
+	const __m256 zero = _mm256_setzero_ps();
+	const __m256 signMask = _mm256_set1_ps(-0.f);
+
+	const __m256i self = _mm256_set1_epi32(int(particleID));
+	const __m256i empty = _mm256_set1_epi32(int(CONTACT_EMPTY_SLOT));
+
+	const __m256 positionX_i = _mm256_set1_ps(particles.positionX[particleID]);
+	const __m256 positionY_i = _mm256_set1_ps(particles.positionY[particleID]);
+	const __m256 positionZ_i = _mm256_set1_ps(particles.positionZ[particleID]);
+	const __m256 velocityX_i = _mm256_set1_ps(particles.velocityX[particleID]);
+	const __m256 velocityY_i = _mm256_set1_ps(particles.velocityY[particleID]);
+	const __m256 velocityZ_i = _mm256_set1_ps(particles.velocityZ[particleID]);
+
+	bool filterBodies = particles.body != NULL;
+	const __m256i body_i = _mm256_set1_epi32(filterBodies ? int(particles.body[particleID]) : 0);
+
+	__m256 forceX = zero, forceY = zero, forceZ = zero;
+	__m256 deepest = zero;
+
+	for (int first = 0; first < numCandidates; first += 8) {
+
+		__m256i indices;
+		if (numCandidates - first >= 8) {
+			indices = _mm256_loadu_si256(reinterpret_cast<__m256i const *>(candidates + first));
+		}
+		else {
+			unsigned int tail[8];
+			for (int lane = 0; lane < 8; lane++) tail[lane] = first + lane < numCandidates ? candidates[first + lane] : CONTACT_EMPTY_SLOT;
+			indices = _mm256_loadu_si256(reinterpret_cast<__m256i const *>(tail));
+		}
+
+		__m256i invalid = _mm256_or_si256(_mm256_cmpeq_epi32(indices, empty), _mm256_cmpeq_epi32(indices, self));
+		if (_mm256_movemask_ps(_mm256_castsi256_ps(invalid)) == 0xFF) continue;
+
+		indices = _mm256_blendv_epi8(indices, self, invalid);
+
+		// Only the body ids are fetched for the particles of the own body
+		if (filterBodies) {
+			__m256i body_j = _mm256_i32gather_epi32(reinterpret_cast<int const *>(particles.body), indices, 4);
+			invalid = _mm256_or_si256(invalid, _mm256_cmpeq_epi32(body_j, body_i));
+			if (_mm256_movemask_ps(_mm256_castsi256_ps(invalid)) == 0xFF) continue;
+		}
+
+		__m256 relativeX = _mm256_andnot_ps(signMask, _mm256_sub_ps(positionX_i, _mm256_i32gather_ps(particles.positionX, indices, 4)));
+		__m256 relativeY = _mm256_andnot_ps(signMask, _mm256_sub_ps(positionY_i, _mm256_i32gather_ps(particles.positionY, indices, 4)));
+		__m256 relativeZ = _mm256_andnot_ps(signMask, _mm256_sub_ps(positionZ_i, _mm256_i32gather_ps(particles.positionZ, indices, 4)));
+
+		__m256 distance = _mm256_sqrt_ps(_mm256_add_ps(_mm256_add_ps(
+			_mm256_mul_ps(relativeX, relativeX), _mm256_mul_ps(relativeY, relativeY)), _mm256_mul_ps(relativeZ, relativeZ)));
+
+		__m256 colliding = _mm256_and_ps(_mm256_cmp_ps(distance, particleDiameter, _CMP_LT_OQ), _mm256_cmp_ps(distance, zero, _CMP_GT_OQ));
+		colliding = _mm256_andnot_ps(_mm256_castsi256_ps(invalid), colliding);
+		if (_mm256_movemask_ps(colliding) == 0) continue;
+
+		deepest = _mm256_max_ps(deepest, _mm256_and_ps(colliding, _mm256_sub_ps(particleDiameter, distance)));
+
+		__m256 velocityX_ij = _mm256_sub_ps(velocityX_i, _mm256_i32gather_ps(particles.velocityX, indices, 4));
+		__m256 velocityY_ij = _mm256_sub_ps(velocityY_i, _mm256_i32gather_ps(particles.velocityY, indices, 4));
+		__m256 velocityZ_ij = _mm256_sub_ps(velocityZ_i, _mm256_i32gather_ps(particles.velocityZ, indices, 4));
+
+		// Masked lanes may divide by zero - they are discarded below
+		__m256 springMagnitude = _mm256_mul_ps(negativeSpringCoefficient, _mm256_sub_ps(dampingCoefficient, distance));
+
+		__m256 relative[3] = { relativeX, relativeY, relativeZ };
+		__m256 velocity[3] = { velocityX_ij, velocityY_ij, velocityZ_ij };
+		__m256 * forces[3] = { &forceX, &forceY, &forceZ };
+
+		for (int c = 0; c < 3; c++) {
+			__m256 normal = _mm256_div_ps(relative[c], distance);
+
+			__m256 forceSpring = _mm256_mul_ps(springMagnitude, normal);
+			__m256 forceDamp = _mm256_mul_ps(particleDiameter, velocity[c]);
+			__m256 forceTangential = _mm256_mul_ps(springCoefficient, _mm256_sub_ps(velocity[c], _mm256_mul_ps(_mm256_mul_ps(velocity[c], normal), normal)));
+
+			__m256 sum = _mm256_add_ps(_mm256_add_ps(forceSpring, forceDamp), forceTangential);
+			*forces[c] = _mm256_add_ps(*forces[c], _mm256_and_ps(colliding, sum));
+		}
+	}
+
+	force[0] += horizontalSumAVX2(forceX);
+	force[1] += horizontalSumAVX2(forceY);
+	force[2] += horizontalSumAVX2(forceZ);
+	*overlap = std::max(*overlap, horizontalMaxAVX2(deepest));
+}
+
+// --------------------------------------------------
+//  AVX-512 - 16 candidates per instruction
+// --------------------------------------------------
+
+/**
+* @brief AVX-512 implementation of the contact loop. Works like the AVX2 version with 16 lanes and mask registers
+*/
+TARGET_AVX512 static void contactKernelAVX512(ContactParticles const & particles, unsigned int particleID,
+	unsigned int const * candidates, int numCandidates, ContactParameters const & parameters, float * force, float * overlap)
+{
+	const __m512 springCoefficient = _mm512_set1_ps(parameters.springCoefficient);
+	const __m512 negativeSpringCoefficient = _mm512_set1_ps(-1.f * parameters.springCoefficient);
+	const __m512 dampingCoefficient = _mm512_set1_ps(parameters.dampingCoefficient);
+	const __m512 particleDiameter = _mm512_set1_ps(parameters.particleDiameter);
+	const __m512 zero = _mm512_setzero_ps();
+
+	const __m512i self = _mm512_set1_epi32(int(particleID));
+	const __m512i empty = _mm512_set1_epi32(int(CONTACT_EMPTY_SLOT));
+
+	const __m512 positionX_i = _mm512_set1_ps(particles.positionX[particleID]);
+	const __m512 positionY_i = _mm512_set1_ps(particles.positionY[particleID]);
+	const __m512 positionZ_i = _mm512_set1_ps(particles.positionZ[particleID]);
+	const __m512 velocityX_i = _mm512_set1_ps(particles.velocityX[particleID]);
+	const __m512 velocityY_i = _mm512_set1_ps(particles.velocityY[particleID]);
+	const __m512 velocityZ_i = _mm512_set1_ps(particles.velocityZ[particleID]);
+
+	bool filterBodies = particles.body != NULL;
+	const __m512i body_i = _mm512_set1_epi32(filterBodies ? int(particles.body[particleID]) : 0);
+
+	__m512 forceX = zero, forceY = zero, forceZ = zero;
+	__m512 deepest = zero;
+
+	for (int first = 0; first < numCandidates; first += 16) {
+
+		int remaining = numCandidates - first;
+		__mmask16 loadMask = remaining >= 16 ? __mmask16(0xFFFF) : __mmask16((1u << remaining) - 1u);
+		__m512i indices = _mm512_mask_loadu_epi32(empty, loadMask, candidates + first);
+
+		__mmask16 valid = _mm512_cmpneq_epi32_mask(indices, empty) & _mm512_cmpneq_epi32_mask(indices, self);
+		if (valid == 0) continue;
+
+		indices = _mm512_mask_blend_epi32(valid, self, indices);
+
+		// Only the body ids are fetched for the particles of the own body
+		if (filterBodies) {
+			__m512i body_j = _mm512_mask_i32gather_epi32(body_i, valid, indices, particles.body, 4);
+			valid = _mm512_mask_cmpneq_epi32_mask(valid, body_j, body_i);
+			if (valid == 0) continue;
+		}
+
+		__m512 relativeX = _mm512_abs_ps(_mm512_sub_ps(positionX_i, _mm512_i32gather_ps(indices, particles.positionX, 4)));
+		__m512 relativeY = _mm512_abs_ps(_mm512_sub_ps(positionY_i, _mm512_i32gather_ps(indices, particles.positionY, 4)));
+		__m512 relativeZ = _mm512_abs_ps(_mm512_sub_ps(positionZ_i, _mm512_i32gather_ps(indices, particles.positionZ, 4)));
+
+		__m512 distance = _mm512_sqrt_ps(_mm512_add_ps(_mm512_add_ps(
+			_mm512_mul_ps(relativeX, relativeX), _mm512_mul_ps(relativeY, relativeY)), _mm512_mul_ps(relativeZ, relativeZ)));
+
+		__mmask16 colliding = valid
+			& _mm512_cmp_ps_mask(distance, particleDiameter, _CMP_LT_OQ)
+			& _mm512_cmp_ps_mask(distance, zero, _CMP_GT_OQ);
+		if (colliding == 0) continue;
+
+		deepest = _mm512_mask_max_ps(deepest, colliding, deepest, _mm512_sub_ps(particleDiameter, distance));
+
+		__m512 velocityX_ij = _mm512_sub_ps(velocityX_i, _mm512_i32gather_ps(indices, particles.velocityX, 4));
+		__m512 velocityY_ij = _mm512_sub_ps(velocityY_i, _mm512_i32gather_ps(indices, particles.velocityY, 4));
+		__m512 velocityZ_ij = _mm512_sub_ps(velocityZ_i, _mm512_i32gather_ps(indices, particles.velocityZ, 4));
+
+		__m512 springMagnitude = _mm512_mul_ps(negativeSpringCoefficient, _mm512_sub_ps(dampingCoefficient, distance));
+
+		__m512 relative[3] = { relativeX, relativeY, relativeZ };
+		__m512 velocity[3] = { velocityX_ij, velocityY_ij, velocityZ_ij };
+		__m512 * forces[3] = { &forceX, &forceY, &forceZ };
+
+		for (int c = 0; c < 3; c++) {
+			__m512 normal = _mm512_maskz_div_ps(colliding, relative[c], distance);
+
+			__m512 forceSpring = _mm512_mul_ps(springMagnitude, normal);
+			__m512 forceDamp = _mm512_mul_ps(particleDiameter, velocity[c]);
+			__m512 forceTangential = _mm512_mul_ps(springCoefficient, _mm512_sub_ps(velocity[c], _mm512_mul_ps(_mm512_mul_ps(velocity[c], normal), normal)));
+
+			__m512 sum = _mm512_add_ps(_mm512_add_ps(forceSpring, forceDamp), forceTangential);
+			*forces[c] = _mm512_mask_add_ps(*forces[c], colliding, *forces[c], sum);
+		}
+	}
+
+	force[0] += _mm512_reduce_add_ps(forceX);
+	force[1] += _mm512_reduce_add_ps(forceY);
+	force[2] += _mm512_reduce_add_ps(forceZ);
+	*overlap = std::max(*overlap, _mm512_reduce_max_ps(deepest));
+}
+
+#endif /* CONTACT_KERNEL_X86 */
+
+// --------------------------------------------------
+//  Dispatch
+// --------------------------------------------------
+
+#ifdef CONTACT_KERNEL_X86
+
+/** @brief Executes cpuid for the given leaf and subleaf
+*/
+static void cpuid(int leaf, int subleaf, unsigned int * registers)
+{
+#ifdef _MSC_VER
+	int info[4];
+	__cpuidex(info, leaf, subleaf);
+	for (int i = 0; i < 4; i++) registers[i] = (unsigned int)info[i];
+#else
+	__asm__ __volatile__("cpuid" : "=a"(registers[0]), "=b"(registers[1]), "=c"(registers[2]), "=d"(registers[3]) : "a"(leaf), "c"(subleaf));
+#endif
+}
+
+/** @brief Returns the register state the operating system saves on context switches
+*/
+static unsigned long long xgetbv(void)
+{
+#ifdef _MSC_VER
+	return _xgetbv(0);
+#else
+	unsigned int eax, edx;
+	__asm__ __volatile__("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+	return ((unsigned long long)edx << 32) | eax;
+#endif
+}
+
+#endif /* CONTACT_KERNEL_X86 */
+
+/**
+* @brief Returns true if the CPU and the operating system support the instruction set
+*/
+bool isContactKernelSupported(ContactKernelISA isa)
+{
+	if (isa == ContactKernelScalar) return true;
+
+#ifdef CONTACT_KERNEL_X86
+	unsigned int registers[4];
+
+	cpuid(0, 0, registers);
+	if (registers[0] < 7) return false;
+
+	// OSXSAVE and AVX
+	cpuid(1, 0, registers);
+	if ((registers[2] & (1u << 27)) == 0 || (registers[2] & (1u << 28)) == 0) return false;
+
+	unsigned long long xcr0 = xgetbv();
+	if ((xcr0 & 0x6) != 0x6) return false; // SSE and AVX state
+
+	cpuid(7, 0, registers);
+
+	if (isa == ContactKernelAVX2) return (registers[1] & (1u << 5)) != 0;
+	if (isa == ContactKernelAVX512) return (registers[1] & (1u << 16)) != 0 && (xcr0 & 0xE6) == 0xE6; // AVX512F and opmask/ZMM state
+#endif
+
+	return false;
+}
+
+/**
+* @brief Returns the widest instruction set the contact kernel supports on this machine
+*/
+ContactKernelISA detectContactKernelISA(void)
+{
+	if (isContactKernelSupported(ContactKernelAVX512)) return ContactKernelAVX512;
+	if (isContactKernelSupported(ContactKernelAVX2)) return ContactKernelAVX2;
+	return ContactKernelScalar;
+}
+
+/**
+* @brief Returns the kernel for the given instruction set. Falls back to the scalar kernel if it is not supported
+*/
+ContactKernelFunction getContactKernel(ContactKernelISA isa)
+{
+#ifdef CONTACT_KERNEL_X86
+	if (isContactKernelSupported(isa)) {
+		if (isa == ContactKernelAVX512) return contactKernelAVX512;
+		if (isa == ContactKernelAVX2) return contactKernelAVX2;
+	}
+#endif
+	return contactKernelScalar;
+}
+
+/** @brief Returns a printable name of the instruction set
+*/
+const char * getContactKernelName(ContactKernelISA isa)
+{
+	switch (isa) {
+	case ContactKernelAVX512: return "AVX-512";
+	case ContactKernelAVX2: return "AVX2";
+	default: return "Scalar";
+	}
+}
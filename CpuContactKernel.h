@@ -0,0 +1,39 @@
+#pragma once
+
+// Marks an unused candidate slot - such candidates are skipped like the particle itself
+const unsigned int CONTACT_EMPTY_SLOT = 0xFFFFFFFFu;
+
+// Instruction sets the contact kernel is available for
+enum ContactKernelISA {
+	ContactKernelScalar = 0,
+	ContactKernelAVX2 = 1,
+	ContactKernelAVX512 = 2
+};
+
+// Particle streams the kernel gathers the candidates from
+struct ContactParticles {
+	float const * positionX;
+	float const * positionY;
+	float const * positionZ;
+	float const * velocityX;
+	float const * velocityY;
+	float const * velocityZ;
+	unsigned int const * body; // Rigid body of each particle - candidates of the own body are skipped. NULL tests them
+};
+
+// Coefficients of the spring, damping and tangential terms of collision.frag
+struct ContactParameters {
+	float springCoefficient;
+	float dampingCoefficient;
+	float particleDiameter;
+};
+
+// Adds the contact forces of all candidates onto force and raises overlap to the deepest penetration of a candidate.
+// Empty slots, the particle itself and the particles of its own body are masked out
+typedef void (*ContactKernelFunction)(ContactParticles const & particles, unsigned int particleID,
+	unsigned int const * candidates, int numCandidates, ContactParameters const & parameters, float * force, float * overlap);
+
+ContactKernelISA detectContactKernelISA(void);
+bool isContactKernelSupported(ContactKernelISA isa);
+ContactKernelFunction getContactKernel(ContactKernelISA isa);
+const char * getContactKernelName(ContactKernelISA isa);
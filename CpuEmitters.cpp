@@ -0,0 +1,192 @@
+#include "CpuEmitters.h"
+#include <algorithm>
+#include <cmath>
+
+CpuEmitters::CpuEmitters()
+{
+}
+
+
+CpuEmitters::~CpuEmitters()
+{
+}
+
+/** @brief Removes all emitters
+*/
+void CpuEmitters::clear(void)
+{
+	emitters.clear();
+	reset();
+}
+
+/** @brief Forgets the owed spawns and restarts the random numbers of all emitters at their seeds
+*/
+void CpuEmitters::reset(void)
+{
+	states.assign(emitters.size(), EmitterState());
+	for (size_t emitter = 0; emitter < emitters.size(); emitter++) states[emitter].random = emitters[emitter].seed;
+}
+
+/** @brief Replaces the emitters and the spawns they owe, e.g. by the ones of a checkpoint
+*/
+void CpuEmitters::restore(std::vector<Emitter> const & emitters, std::vector<EmitterState> const & states)
+{
+	this->emitters = emitters;
+	this->states = states;
+	this->states.resize(emitters.size());
+}
+
+/** @brief Appends an emitter and returns its index, -1 if the rate or the spread of the speeds is negative
+*/
+int CpuEmitters::addEmitter(Emitter const & emitter)
+{
+	if (emitter.rate < 0.f || emitter.speedVariation < 0.f) return -1;
+
+	EmitterState state;
+	state.random = emitter.seed;
+
+	emitters.push_back(emitter);
+	states.push_back(state);
+
+	return int(emitters.size()) - 1;
+}
+
+/**
+* @brief Changes the settings of an emitter, e.g. to move it or change its rate. The owed spawns and the random numbers go on
+*/
+bool CpuEmitters::setEmitter(int emitter, Emitter const & settings)
+{
+	if (emitter < 0 || emitter >= getNumEmitters() || settings.rate < 0.f || settings.speedVariation < 0.f) return false;
+
+	emitters[emitter] = settings;
+	return true;
+}
+
+/**
+* @brief Adds numBodies spawns to the emitter. The next steps spawn them as soon as there is room for them
+*/
+bool CpuEmitters::burst(int emitter, int numBodies)
+{
+	if (emitter < 0 || emitter >= getNumEmitters() || numBodies < 0) return false;
+
+	states[emitter].burstSpawns += numBodies;
+	return true;
+}
+
+/**
+* @brief Turns deltaT seconds of the rates into whole spawns. Spawns of the rate which were not placed since the last update
+* are dropped, so a blocked emitter does not flood the scene once there is room again
+*/
+void CpuEmitters::update(float deltaT)
+{
+	for (size_t emitter = 0; emitter < emitters.size(); emitter++) {
+
+		EmitterState & state = states[emitter];
+
+		if (!emitters[emitter].enabled) {
+			state.rateSpawns = 0;
+			continue;
+		}
+
+		state.rateCredit += emitters[emitter].rate * deltaT;
+		float spawns = std::floor(state.rateCredit);
+
+		state.rateSpawns = int(spawns);
+		state.rateCredit -= spawns;
+	}
+}
+
+/** @brief Returns the number of spawns the emitter owes, none if it is disabled
+*/
+int CpuEmitters::getPendingSpawns(int emitter) const
+{
+	return emitters[emitter].enabled ? states[emitter].rateSpawns + states[emitter].burstSpawns : 0;
+}
+
+/** @brief Marks one of the owed spawns of the emitter as spawned, the spawns of the rate first
+*/
+void CpuEmitters::spawned(int emitter)
+{
+	EmitterState & state = states[emitter];
+
+	if (state.rateSpawns > 0) state.rateSpawns--;
+	else if (state.burstSpawns > 0) state.burstSpawns--;
+}
+
+/**
+* @brief Draws the position and velocity of the next spawn candidate of the emitter
+* @param position	Point of the box of the emitter
+* @param velocity	Velocity in the cone of the emitter
+*/
+void CpuEmitters::drawCandidate(int emitter, float * position, float * velocity)
+{
+	Emitter const & settings = emitters[emitter];
+
+	for (int c = 0; c < 3; c++) position[c] = settings.position[c] + settings.extent[c] * (2.f * random(emitter) - 1.f);
+
+	float speed = std::sqrt(settings.velocity[0] * settings.velocity[0] + settings.velocity[1] * settings.velocity[1]
+		+ settings.velocity[2] * settings.velocity[2]);
+
+	// Both random numbers of the direction are drawn for every candidate, so the sequence does not depend on the cone
+	float cosTheta = 1.f - random(emitter) * (1.f - std::cos(std::min(settings.coneAngle, 3.14159265f)));
+	float phi = 2.f * 3.14159265f * random(emitter);
+	float scale = 1.f + settings.speedVariation * (2.f * random(emitter) - 1.f);
+
+	if (speed == 0.f) {
+		for (int c = 0; c < 3; c++) velocity[c] = 0.f;
+		return;
+	}
+
+	// Orthonormal basis around the axis of the cone
+	float axis[3] = { settings.velocity[0] / speed, settings.velocity[1] / speed, settings.velocity[2] / speed };
+	float helper[3] = { 0.f, 0.f, 0.f };
+	helper[std::abs(axis[0]) < .9f ? 0 : 1] = 1.f;
+
+	float u[3] = { axis[1] * helper[2] - axis[2] * helper[1], axis[2] * helper[0] - axis[0] * helper[2], axis[0] * helper[1] - axis[1] * helper[0] };
+	float length = std::sqrt(u[0] * u[0] + u[1] * u[1] + u[2] * u[2]);
+	for (int c = 0; c < 3; c++) u[c] /= length;
+
+	float v[3] = { axis[1] * u[2] - axis[2] * u[1], axis[2] * u[0] - axis[0] * u[2], axis[0] * u[1] - axis[1] * u[0] };
+
+	float sinTheta = std::sqrt(std::max(0.f, 1.f - cosTheta * cosTheta));
+	for (int c = 0; c < 3; c++) {
+		float direction = axis[c] * cosTheta + (u[c] * std::cos(phi) + v[c] * std::sin(phi)) * sinTheta;
+		velocity[c] = direction * speed * std::max(scale, 0.f);
+	}
+}
+
+/** @brief Returns the number of emitters
+*/
+int CpuEmitters::getNumEmitters(void) const
+{
+	return int(emitters.size());
+}
+
+/** @brief Returns the settings of the given emitter
+*/
+Emitter const & CpuEmitters::getEmitter(int emitter) const
+{
+	return emitters[emitter];
+}
+
+/** @brief Returns the spawns the given emitter owes and the state of its random numbers
+*/
+EmitterState const & CpuEmitters::getState(int emitter) const
+{
+	return states[emitter];
+}
+
+/**
+* @brief Returns the next random number in [0, 1) of the emitter - splitmix64, which is the same on every platform unlike the
+* generators of the standard library
+*/
+float CpuEmitters::random(int emitter)
+{
+	unsigned long long z = (states[emitter].random += 0x9E3779B97F4A7C15ull);
+	z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+	z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+	z = z ^ (z >> 31);
+
+	// The upper 24 bits fill the mantissa exactly
+	return float(z >> 40) / 16777216.f;
+}
@@ -0,0 +1,58 @@
+#pragma once
+#include <vector>
+
+// Source of spawned rigid bodies. Bodies spawn at random points of a box around the position with a random velocity of a cone
+// around the velocity of the emitter
+struct Emitter {
+	float position[3] = { 0.f, .5f, 0.f };
+	float extent[3] = { 0.f, 0.f, 0.f }; // Half edge lengths of the box, 0 spawns at the position
+	float rate = 1.f; // Bodies per second of simulated time, 0 only spawns bursts
+	float velocity[3] = { 0.f, 0.f, 0.f }; // Initial velocity along the axis of the cone
+	float coneAngle = 0.f; // Half opening angle of the cone in radians
+	float speedVariation = 0.f; // Speeds are spread evenly over |velocity| * (1 +- speedVariation)
+	int type = -1; // Body type of the spawned bodies, -1 follows the spawn sequence of the solver
+	bool enabled = true;
+	unsigned int seed = 1u; // Seed of the random positions and velocities, emitters with the same seed draw the same ones
+};
+
+// Spawns an emitter owes and the state of its random numbers. Spawns of the rate which find no room are dropped with the next
+// update, bursts wait for room
+struct EmitterState {
+	int rateSpawns = 0;
+	float rateCredit = 0.f; // Fraction of a spawn the rate accumulated
+	int burstSpawns = 0;
+	unsigned long long random = 0ull;
+};
+
+// Emitters of the solver and the spawns they owe. Rates accumulate into whole spawns, bursts add spawns at once. All random
+// numbers come from one generator per emitter, so the candidates only depend on the emitter and its spawns since the reset
+class CpuEmitters
+{
+public:
+	CpuEmitters();
+	~CpuEmitters();
+
+	void clear(void);
+	void reset(void);
+	void restore(std::vector<Emitter> const & emitters, std::vector<EmitterState> const & states);
+	int addEmitter(Emitter const & emitter);
+	bool setEmitter(int emitter, Emitter const & settings);
+	bool burst(int emitter, int numBodies);
+	void update(float deltaT);
+
+	int getPendingSpawns(int emitter) const;
+	void spawned(int emitter);
+	void drawCandidate(int emitter, float * position, float * velocity);
+
+	int getNumEmitters(void) const;
+	Emitter const & getEmitter(int emitter) const;
+	EmitterState const & getState(int emitter) const;
+
+private:
+
+	float random(int emitter);
+
+	std::vector<Emitter> emitters;
+	std::vector<EmitterState> states;
+
+};
@@ -0,0 +1,76 @@
+#include "CpuIntegrator.h"
+#include <cmath>
+
+/**
+* @brief Moves the bodies [begin, end) along their velocities and rotates them by their angular velocities for deltaT seconds.
+* Shared by all integrators - the Runge-Kutta stages pass their weighted velocities
+*/
+void advanceBodies(IntegratorStreams const & streams, int begin, int end, float deltaT)
+{
+	for (int body = begin; body < end; body++) {
+
+		if (streams.skip != NULL && streams.skip[body]) continue;
+
+		float q[4], angularVelocity[3], rotated[4];
+
+		for (int c = 0; c < 4; c++) q[c] = streams.quaternion[c][body];
+		for (int c = 0; c < 3; c++) angularVelocity[c] = streams.angularVelocity[c][body];
+
+		rotateQuaternion(q, angularVelocity, deltaT, rotated);
+		for (int c = 0; c < 4; c++) streams.outQuaternion[c][body] = rotated[c];
+
+		for (int c = 0; c < 3; c++) streams.outPosition[c][body] = streams.position[c][body] + streams.velocity[c][body] * deltaT;
+	}
+}
+
+/**
+* @brief Counterpart of the quaternion update of solver.frag: multiplies the differential quaternion of the angular velocity
+* onto q. The scalar part of the quaternions is stored in x
+*/
+void rotateQuaternion(float const * q, float const * angularVelocity, float deltaT, float * out)
+{
+	float angularSpeed = std::sqrt(angularVelocity[0] * angularVelocity[0] + angularVelocity[1] * angularVelocity[1] + angularVelocity[2] * angularVelocity[2]);
+	float theta = angularSpeed * deltaT;
+
+	float a[3] = { 0.f, 0.f, 0.f };
+	if (angularSpeed > 0.001f) {
+		for (int i = 0; i < 3; i++) a[i] = angularVelocity[i] / angularSpeed;
+	}
+
+	float dq[4] = { std::cos(theta / 2.f), a[0] * std::sin(theta / 2.f), a[1] * std::sin(theta / 2.f), a[2] * std::sin(theta / 2.f) };
+
+	// Quaternion multiplication dq * q
+	float vectorCross[3] = {
+		dq[2] * q[3] - dq[3] * q[2],
+		dq[3] * q[1] - dq[1] * q[3],
+		dq[1] * q[2] - dq[2] * q[1]
+	};
+
+	out[0] = dq[0] * q[0] - (dq[1] * q[1] + dq[2] * q[2] + dq[3] * q[3]);
+	for (int c = 1; c < 4; c++) out[c] = dq[0] * q[c] + q[0] * dq[c] + vectorCross[c - 1];
+}
+
+/** @brief Returns the number of force evaluations - runs of the particle passes - per step
+*/
+int getIntegratorEvaluations(IntegratorType type)
+{
+	switch (type) {
+	case IntegratorRK2: return 2;
+	case IntegratorRK4: return 4;
+	default: return 1;
+	}
+}
+
+/** @brief Returns a printable name of the integrator
+*/
+const char * getIntegratorName(IntegratorType type)
+{
+	switch (type) {
+	case IntegratorExplicitEuler: return "Explicit Euler";
+	case IntegratorSemiImplicitEuler: return "Semi-implicit Euler";
+	case IntegratorVerlet: return "Verlet";
+	case IntegratorRK2: return "RK2";
+	case IntegratorRK4: return "RK4";
+	default: return "Unknown";
+	}
+}
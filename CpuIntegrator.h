@@ -0,0 +1,26 @@
+#pragma once
+
+// Time integration of the rigid bodies in solverPass()
+enum IntegratorType {
+	IntegratorExplicitEuler = 0,		// solver.frag - the momenta hold the impulse of the last step only
+	IntegratorSemiImplicitEuler = 1,	// Symplectic Euler - the momenta accumulate, the bodies move with the new momenta
+	IntegratorVerlet = 2,				// Stoermer-Verlet positions from the last two steps, symplectic Euler rotation
+	IntegratorRK2 = 3,					// Midpoint method - two force evaluations per step
+	IntegratorRK4 = 4					// Classical Runge-Kutta - four force evaluations per step
+};
+
+// Structure of arrays streams of one batched position and quaternion update
+struct IntegratorStreams {
+	float const * position[3];
+	float const * quaternion[4];
+	float const * velocity[3];
+	float const * angularVelocity[3];
+	float * outPosition[3];
+	float * outQuaternion[4];
+	unsigned char const * skip; // Bodies with a non zero entry are not written. NULL advances all of them
+};
+
+void advanceBodies(IntegratorStreams const & streams, int begin, int end, float deltaT);
+void rotateQuaternion(float const * q, float const * angularVelocity, float deltaT, float * out);
+int getIntegratorEvaluations(IntegratorType type);
+const char * getIntegratorName(IntegratorType type);
@@ -0,0 +1,64 @@
+#include "CpuIslands.h"
+
+CpuIslands::CpuIslands()
+{
+}
+
+
+CpuIslands::~CpuIslands()
+{
+}
+
+/**
+* @brief Finds the islands of the given bodies
+* @param numBodies	Number of rigid bodies
+* @param pairs		Pairs of bodies which may touch, e.g. CpuBroadPhase::getPairs()
+*/
+void CpuIslands::build(int numBodies, std::vector<BodyPair> const & pairs)
+{
+	parents.resize(numBodies);
+	for (int body = 0; body < numBodies; body++) parents[body] = unsigned(body);
+
+	// The larger root is linked below the smaller one
+	for (size_t i = 0; i < pairs.size(); i++) {
+		unsigned int a = findRoot(pairs[i].first);
+		unsigned int b = findRoot(pairs[i].second);
+
+		if (a < b) parents[b] = a;
+		else if (b < a) parents[a] = b;
+	}
+
+	// Roots precede the other bodies of their tree, so their island is known when the others are visited
+	bodyIslands.resize(numBodies);
+	numIslands = 0;
+
+	for (int body = 0; body < numBodies; body++) {
+		unsigned int root = findRoot(unsigned(body));
+		bodyIslands[body] = root == unsigned(body) ? unsigned(numIslands++) : bodyIslands[root];
+	}
+}
+
+/** @brief Returns the number of islands found by the last build
+*/
+int CpuIslands::getNumIslands(void) const
+{
+	return numIslands;
+}
+
+/** @brief Returns the island of every body, numbered from 0 to getNumIslands() - 1
+*/
+std::vector<unsigned int> const & CpuIslands::getBodyIslands(void) const
+{
+	return bodyIslands;
+}
+
+/** @brief Returns the root of the tree of the given body and halves the path to it
+*/
+unsigned int CpuIslands::findRoot(unsigned int body)
+{
+	while (parents[body] != body) {
+		parents[body] = parents[parents[body]];
+		body = parents[body];
+	}
+	return body;
+}
@@ -0,0 +1,28 @@
+#pragma once
+#include <vector>
+#include "CpuBroadPhase.h"
+
+// Connected components of the contact graph. The bodies are the nodes, the pairs of the broad phase the edges. Islands are
+// numbered in the order of their first body, so the numbering only depends on the pairs and not on their order
+class CpuIslands
+{
+public:
+	CpuIslands();
+	~CpuIslands();
+
+	void build(int numBodies, std::vector<BodyPair> const & pairs);
+
+	int getNumIslands(void) const;
+	std::vector<unsigned int> const & getBodyIslands(void) const;
+
+private:
+
+	unsigned int findRoot(unsigned int body);
+
+	// Union find forest - the root of a tree is the body with the smallest index
+	std::vector<unsigned int> parents;
+
+	std::vector<unsigned int> bodyIslands;
+	int numIslands = 0;
+
+};
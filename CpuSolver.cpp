@@ -0,0 +1,2581 @@
+#include "CpuSolver.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <unordered_map>
+
+// --------------------------------------------------
+//  Math helpers - matrices are column major like glm
+// --------------------------------------------------
+
+/** @brief Counterpart of quaternion2rotation() of the shaders. The scalar part of the quaternion is stored in x
+*/
+static void quaternion2rotation(float const * q, float * rotation)
+{
+	rotation[0] = 1.f - 2.f * q[2] * q[2] - 2.f * q[3] * q[3];
+	rotation[1] = 2.f * q[1] * q[2] + 2.f * q[0] * q[3];
+	rotation[2] = 2.f * q[1] * q[3] - 2.f * q[0] * q[2];
+
+	rotation[3] = 2.f * q[1] * q[2] - 2.f * q[0] * q[3];
+	rotation[4] = 1.f - 2.f * q[1] * q[1] - 2.f * q[3] * q[3];
+	rotation[5] = 2.f * q[2] * q[3] + 2.f * q[0] * q[1];
+
+	// Keeps the first term of the shaders (y * z instead of y * w) so both produce the same state
+	rotation[6] = 2.f * q[1] * q[2] + 2.f * q[0] * q[2];
+	rotation[7] = 2.f * q[2] * q[3] - 2.f * q[0] * q[1];
+	rotation[8] = 1.f - 2.f * q[1] * q[1] - 2.f * q[2] * q[2];
+}
+
+/** @brief Normalizes the given quaternion into out
+*/
+static void normalizeQuaternion(float const * q, float * out)
+{
+	float length = std::sqrt(q[0] * q[0] + q[1] * q[1] + q[2] * q[2] + q[3] * q[3]);
+	float inverseLength = length > 0.f ? 1.f / length : 0.f;
+
+	for (int i = 0; i < 4; i++) out[i] = q[i] * inverseLength;
+}
+
+/** @brief Calculates out = a * b
+*/
+static void multiplyMatrix(float const * a, float const * b, float * out)
+{
+	for (int col = 0; col < 3; col++) {
+		for (int row = 0; row < 3; row++) {
+			out[col * 3 + row] = a[row] * b[col * 3] + a[3 + row] * b[col * 3 + 1] + a[6 + row] * b[col * 3 + 2];
+		}
+	}
+}
+
+/** @brief Calculates out = m * v
+*/
+static void multiplyVector(float const * m, float const * v, float * out)
+{
+	for (int row = 0; row < 3; row++) {
+		out[row] = m[row] * v[0] + m[3 + row] * v[1] + m[6 + row] * v[2];
+	}
+}
+
+/** @brief Calculates the world space inverse inertia tensor R * I^-1 * R^T
+*/
+static void worldInverseInertia(float const * rotation, float const * invInertia, float * out)
+{
+	float rotationTransposed[9];
+	float temp[9];
+
+	for (int col = 0; col < 3; col++) {
+		for (int row = 0; row < 3; row++) {
+			rotationTransposed[col * 3 + row] = rotation[row * 3 + col];
+		}
+	}
+
+	multiplyMatrix(rotation, invInertia, temp);
+	multiplyMatrix(temp, rotationTransposed, out);
+}
+
+/** @brief Spreads the lower 21 bits of v so that two zero bits follow each bit
+*/
+static unsigned long long spreadBits(unsigned long long v)
+{
+	v &= 0x1FFFFFull;
+	v = (v | v << 32) & 0x1F00000000FFFFull;
+	v = (v | v << 16) & 0x1F0000FF0000FFull;
+	v = (v | v << 8) & 0x100F00F00F00F00Full;
+	v = (v | v << 4) & 0x10C30C30C30C30C3ull;
+	v = (v | v << 2) & 0x1249249249249249ull;
+	return v;
+}
+
+/** @brief Returns the Z-order curve key of the given voxel
+*/
+static unsigned long long mortonKey(int x, int y, int z)
+{
+	return spreadBits((unsigned long long)x) | spreadBits((unsigned long long)y) << 1 | spreadBits((unsigned long long)z) << 2;
+}
+
+/** @brief Packs the voxel coordinates into one key - 21 bits per axis, the voxel (0, 0, 0) sits in the middle
+*/
+static unsigned long long voxelKey(int x, int y, int z)
+{
+	const long long offset = 1 << 20;
+	return (unsigned long long)((x + offset) & 0x1FFFFF) | (unsigned long long)((y + offset) & 0x1FFFFF) << 21 | (unsigned long long)((z + offset) & 0x1FFFFF) << 42;
+}
+
+/** @brief Adds the bit patterns of the given floats to a 64 bit FNV-1a hash
+*/
+static unsigned long long hashFloats(unsigned long long hash, float const * values, size_t count)
+{
+	for (size_t i = 0; i < count; i++) {
+		unsigned int bits;
+		std::memcpy(&bits, &values[i], sizeof(bits));
+		hash = (hash ^ bits) * 1099511628211ull;
+	}
+	return hash;
+}
+
+/** @brief Returns the smallest power of two which is not smaller than v
+*/
+static int nextPowerOfTwo(int v)
+{
+	int power = 1;
+	while (power < v) power <<= 1;
+	return power;
+}
+
+// --------------------------------------------------
+//  Solver
+// --------------------------------------------------
+
+// Tag of grid cells holding the particles of more than one body
+static const unsigned int CELL_MIXED_BODIES = 0xFFFFFFFFu;
+
+// Sleep states of the bodies. A body which falls asleep writes its particles once more with zero velocity, afterwards the
+// particle streams keep them. A despawned body waits on the free list and takes no part in any pass
+static const unsigned char BODY_AWAKE = 0;
+static const unsigned char BODY_FALLING_ASLEEP = 1;
+static const unsigned char BODY_ASLEEP = 2;
+static const unsigned char BODY_DESPAWNED = 3;
+
+CpuSolver::CpuSolver()
+{
+	const float btmLeftFront[3] = { -.5f, -.5f, -.5f };
+	const float topRightBack[3] = { .5f, .5f, .5f };
+
+	setGrid(btmLeftFront, topRightBack, voxelLength);
+	setEmitterPosition(0.f, .5f, 0.f);
+
+	contactKernelISA = detectContactKernelISA();
+	selectContactKernel();
+}
+
+
+CpuSolver::~CpuSolver()
+{
+}
+
+/**
+* @brief Replaces all body types by the given rigid body model, whose mass follows the mass of the parameters
+* @param particlePositions	numParticles * 3 positions relative to the center of mass (see SolverModel::getParticlePositions())
+* @param numParticles		Number of particles per model
+* @param inertiaTensor		Column major 3x3 inertia tensor of the model
+*/
+bool CpuSolver::setModel(float const * particlePositions, int numParticles, float const * inertiaTensor)
+{
+	if (numParticles <= 0 || particlePositions == NULL) return false;
+
+	bodyTypes.clear();
+	bodyTypes.addType(particlePositions, numParticles, inertiaTensor, 0.f);
+
+	return resetSimulation();
+}
+
+/**
+* @brief Adds another rigid body model to the simulation and resets it. Returns the index of the type or -1 if the template is empty
+* @param particlePositions	numParticles * 3 positions relative to the center of mass
+* @param numParticles		Number of particles of the model
+* @param inertiaTensor		Column major 3x3 inertia tensor of the model
+* @param mass				Mass of one body, 0 follows the mass of the parameters
+*/
+int CpuSolver::addBodyType(float const * particlePositions, int numParticles, float const * inertiaTensor, float mass)
+{
+	int type = bodyTypes.addType(particlePositions, numParticles, inertiaTensor, mass);
+	if (type >= 0) resetSimulation();
+
+	return type;
+}
+
+/**
+* @brief Sets the types of the spawned bodies - body b gets the type types[b % types.size()] - and resets the simulation.
+* By default the bodies cycle through all types. Returns false if the sequence names an unknown type
+*/
+bool CpuSolver::setSpawnTypes(std::vector<int> const & types)
+{
+	if (!bodyTypes.setSpawnTypes(types)) return false;
+
+	return resetSimulation();
+}
+
+/**
+* @brief Sets the space occupied by the solver grid
+* @param btmLeftFront	Corner with the smallest coordinates
+* @param topRightBack	Corner with the largest coordinates
+* @param voxelLength	Voxel edge length which equals the particle diameter
+*/
+void CpuSolver::setGrid(float const * btmLeftFront, float const * topRightBack, float voxelLength)
+{
+	this->voxelLength = voxelLength;
+
+	for (int i = 0; i < 3; i++) {
+		btmLeftFrontCorner[i] = btmLeftFront[i];
+		topRightBackCorner[i] = topRightBack[i];
+		gridResolution[i] = int(std::abs(topRightBack[i] - btmLeftFront[i]) / voxelLength);
+	}
+
+	// The cells are allocated by the grid pass
+	cellStart.clear();
+}
+
+/** @brief Sets the position the first body and, as long as there are no emitters, the spawned bodies start at
+*/
+void CpuSolver::setEmitterPosition(float x, float y, float z)
+{
+	emitterPosition[0] = x;
+	emitterPosition[1] = y;
+	emitterPosition[2] = z;
+}
+
+/**
+* @brief Adds an emitter and returns its index, -1 if its settings are invalid. From now on the emitters spawn the bodies instead
+* of spawnTime, the simulation goes on
+*/
+int CpuSolver::addEmitter(Emitter const & emitter)
+{
+	if (emitter.type < -1) return -1;
+	return emitters.addEmitter(emitter);
+}
+
+/**
+* @brief Changes the settings of an emitter while the simulation goes on
+*/
+bool CpuSolver::setEmitter(int emitter, Emitter const & settings)
+{
+	if (settings.type < -1) return false;
+	return emitters.setEmitter(emitter, settings);
+}
+
+/**
+* @brief Lets the emitter spawn numBodies bodies at once. The next step places as many of them as there is room for without
+* overlaps, the others follow in the steps after
+*/
+bool CpuSolver::burst(int emitter, int numBodies)
+{
+	return emitters.burst(emitter, numBodies);
+}
+
+/** @brief Removes all emitters, the bodies spawn one by one at the emitter position again
+*/
+void CpuSolver::clearEmitters(void)
+{
+	emitters.clear();
+}
+
+/** @brief Returns the simulation parameters
+*/
+CpuSolverParameters & CpuSolver::getParameters(void)
+{
+	return parameters;
+}
+
+/**
+* @brief Selects the instruction set of the contact kernel. Returns false if the machine does not support it
+*/
+bool CpuSolver::setContactKernelISA(ContactKernelISA isa)
+{
+	if (!isContactKernelSupported(isa)) return false;
+
+	contactKernelISA = isa;
+	selectContactKernel();
+	return true;
+}
+
+/**
+* @brief Picks the contact kernel for the instruction set and the deterministic mode. The lanes of the vector kernels add up the
+* forces in a different order than the scalar kernel, so the deterministic mode always runs the scalar one
+*/
+void CpuSolver::selectContactKernel(void)
+{
+	contactKernelDeterministic = parameters.deterministic;
+	contactKernel = getContactKernel(contactKernelDeterministic ? ContactKernelScalar : contactKernelISA);
+}
+
+/** @brief Returns the instruction set the contact kernel runs with
+*/
+ContactKernelISA CpuSolver::getContactKernelISA(void) const
+{
+	return contactKernelISA;
+}
+
+/**
+* @brief Sets the number of threads the passes run on. 0 uses one thread per hardware thread
+*/
+void CpuSolver::setNumThreads(int numThreads)
+{
+	threadPool.setNumThreads(numThreads);
+}
+
+/** @brief Returns the number of threads the passes run on
+*/
+int CpuSolver::getNumThreads(void) const
+{
+	return threadPool.getNumThreads();
+}
+
+/**
+* @brief This function resets the simulation to its initial state
+*/
+bool CpuSolver::resetSimulation(void)
+{
+	spawnedObjects = 1;
+	timeSinceSpawn = 0.f;
+
+	// The storage grows again with the spawned bodies
+	capacity = 0;
+	bodyTypes.layout(0);
+	reserveBodies(1);
+	if (bodyTypes.getNumTypes() > 0) initializeBodies(0, 1);
+
+	particleSlots.clear();
+	slotParticles.clear();
+	broadPhase.clear();
+	emitters.reset();
+
+	// The particles of the last simulation must not block the emitters
+	cellStart.clear();
+	accumulatedTime = 0.f;
+	lastDeltaT = 0.f;
+	nextTimeStep = parameters.timeStep;
+	maxParticleSpeed = 0.f;
+	maxOverlap = 0.f;
+	stateChecksum = 0ull;
+	collisionPassTime = 0.0;
+	sleepingBodies.clear();
+	restingSteps.clear();
+	bodyAges.assign(1, 0.f);
+	freeBodies.assign(bodyTypes.getNumTypes(), std::vector<unsigned int>());
+	numFreeBodies = 0u;
+	spawnCount = 1u;
+	stepCount = 0;
+
+	// The bodies of a new simulation are other bodies, even in the same slots
+	bodyLayout++;
+
+	return true;
+}
+
+/**
+* @brief Grows the storage of the rigid bodies and their particles so it holds at least numBodies bodies. The capacity doubles,
+* so spawning the bodies one by one copies the state only a few times and the memory stays proportional to the spawned bodies
+*/
+void CpuSolver::reserveBodies(int numBodies)
+{
+	if (numBodies <= capacity) return;
+
+	capacity = std::max(numBodies, 2 * capacity);
+
+	// The types of the bodies and so their particle ranges are fixed in advance, the ranges of the existing bodies stay
+	layoutBodies();
+
+	rigidBodies.resize(capacity);
+}
+
+/**
+* @brief Lays out the particles of all bodies the storage holds and splits the large bodies into the blocks of the momenta reduction
+*/
+void CpuSolver::layoutBodies(void)
+{
+	bodyTypes.layout(capacity);
+	layoutPending = false;
+	std::vector<unsigned int> const & bodyOffsets = bodyTypes.getBodyParticleOffsets();
+
+	blockOffsets.resize(capacity + 1);
+	blockOffsets[0] = 0u;
+	blockBodies.clear();
+	largeBodies = false;
+
+	for (int body = 0; body < capacity; body++) {
+		unsigned int numParticles = bodyOffsets[body + 1] - bodyOffsets[body];
+		unsigned int numBlocks = numParticles < unsigned(LARGE_BODY_PARTICLES) ? 1u : (numParticles + PARTICLE_BLOCK_SIZE - 1) / PARTICLE_BLOCK_SIZE;
+
+		blockOffsets[body + 1] = blockOffsets[body] + numBlocks;
+		blockBodies.insert(blockBodies.end(), numBlocks, unsigned(body));
+		largeBodies = largeBodies || numBlocks > 1u;
+	}
+
+	particles.resize(bodyOffsets[capacity]);
+}
+
+/**
+* @brief Puts the bodies [first, last) at the emitter with the initial values of the cleared rigid body textures. Both buffers
+* are initialized
+*/
+void CpuSolver::initializeBodies(int first, int last)
+{
+	// The momenta of the other integrators accumulate, their bodies start at rest
+	bool explicitEuler = parameters.integrator == IntegratorExplicitEuler;
+
+	for (int body = first; body < last; body++) {
+
+		for (int c = 0; c < 3; c++) {
+			rigidBodies.position(c)[body] = emitterPosition[c];
+			rigidBodies.nextPosition(c)[body] = emitterPosition[c];
+		}
+		rigidBodies.position(ComponentW)[body] = 1.f;
+		rigidBodies.nextPosition(ComponentW)[body] = 1.f;
+
+		// glm::quat(1, 0, 0, 0) written as (x, y, z, w)
+		for (int c = 0; c < 4; c++) {
+			rigidBodies.quaternion(c)[body] = c == ComponentW ? 1.f : 0.f;
+			rigidBodies.nextQuaternion(c)[body] = c == ComponentW ? 1.f : 0.f;
+		}
+
+		for (int c = 0; c < 3; c++) {
+			rigidBodies.linearMomentum(c)[body] = c == ComponentY && explicitEuler ? -parameters.gravity * bodyMass(body) : 0.f;
+			rigidBodies.angularMomentum(c)[body] = 0.f;
+			rigidBodies.force(c)[body] = 0.f;
+			rigidBodies.torque(c)[body] = 0.f;
+		}
+	}
+}
+
+/**
+* @brief Advances the simulation by deltaT seconds. Runs the same passes as RigidSolver::Render()
+* @param deltaT		Time step in seconds
+*/
+bool CpuSolver::step(float deltaT)
+{
+	if (bodyTypes.getNumTypes() == 0) return false;
+
+	// The deterministic mode is a parameter - the kernel is only picked again if it changed since the last step
+	if (parameters.deterministic != contactKernelDeterministic) selectContactKernel();
+
+	// Spawning is driven by simulated time instead of the wall clock
+	if (emitters.getNumEmitters() > 0) {
+		emitterPass(deltaT);
+	}
+	else {
+		timeSinceSpawn += deltaT;
+		if (timeSinceSpawn >= parameters.spawnTime && getLiveObjects() <= (unsigned int)parameters.numRigidBodies) {
+			int body = spawnBody(bodyTypes.getSpawnType(spawnCount++));
+			initializeBodies(body, body + 1);
+			timeSinceSpawn = 0.f;
+		}
+	}
+	if (layoutPending) layoutBodies();
+
+	if (parameters.reorderInterval > 0 && stepCount % unsigned(parameters.reorderInterval) == 0) reorderParticles();
+
+	// Particles of newly spawned bodies are appended to the order
+	for (unsigned int particleID = unsigned(particleSlots.size()); particleID < unsigned(getNumParticles()); particleID++) {
+		particleSlots.push_back(particleID);
+		slotParticles.push_back(particleID);
+	}
+
+	sleepingBodies.resize(spawnedObjects, BODY_AWAKE);
+	restingSteps.resize(spawnedObjects, 0u);
+	if (!parameters.sleeping) std::replace_if(sleepingBodies.begin(), sleepingBodies.end(), [](unsigned char state) { return state != BODY_DESPAWNED; }, BODY_AWAKE);
+
+	evaluateForces();
+	solverPass(deltaT);
+	if (parameters.sleeping) islandPass();
+	if (parameters.adaptiveTimeStep) timeStepPass(deltaT);
+
+	// The written buffers become the ones which are read
+	rigidBodies.swap();
+	stepCount++;
+
+	if (parameters.despawnOutsideGrid || parameters.bodyLifetime > 0.f) despawnPass(deltaT);
+	if (parameters.compactInterval > 0 && stepCount % unsigned(parameters.compactInterval) == 0 && numFreeBodies > 0u) compactBodies();
+
+	if (parameters.deterministic) stateChecksum = computeStateChecksum();
+
+	return true;
+}
+
+/**
+* @brief Takes a body of the given type into use and returns it. A despawned body of that type is recycled, otherwise the body is
+* appended to the bodies in use. The caller initializes its state
+*/
+int CpuSolver::spawnBody(unsigned int type)
+{
+	int body = int(spawnedObjects);
+
+	if (!freeBodies[type].empty()) {
+		body = int(freeBodies[type].back());
+		freeBodies[type].pop_back();
+		numFreeBodies--;
+		bodyLayout++;
+	}
+	else {
+		reserveBodies(body + 1);
+		spawnedObjects++;
+
+		// Recycling or the emitters shifted the spawn sequence against the body slots - the particle ranges behind the last body
+		// follow its type. The layout is updated once for all spawns of the step
+		if (bodyTypes.getBodyTypes()[body] != type) {
+			bodyTypes.setBodyType(body, type);
+			layoutPending = true;
+		}
+	}
+
+	sleepingBodies.resize(spawnedObjects, BODY_AWAKE);
+	restingSteps.resize(spawnedObjects, 0u);
+	bodyAges.resize(spawnedObjects, 0.f);
+	sleepingBodies[body] = BODY_AWAKE;
+	restingSteps[body] = 0u;
+	bodyAges[body] = 0.f;
+
+	return body;
+}
+
+/**
+* @brief Spawns the bodies the emitters owe. Each spawn draws up to spawnAttempts candidates and takes the first whose bounding
+* sphere, grown by half a particle diameter, is clear of the bodies placed before and of the particles in the collision grid of
+* the last step. Those moved since, so they also keep the distance their body travels in one step. Spawns without a clear
+* candidate wait for the next step, so a scene fills up without overlapping bodies and the huge contact forces they cause
+*/
+bool CpuSolver::emitterPass(float deltaT)
+{
+	emitters.update(deltaT);
+
+	int numPending = 0;
+	for (int emitter = 0; emitter < emitters.getNumEmitters(); emitter++) numPending += emitters.getPendingSpawns(emitter);
+	if (numPending == 0) return true;
+
+	std::vector<unsigned int> const & types = bodyTypes.getBodyTypes();
+	sleepingBodies.resize(spawnedObjects, BODY_AWAKE);
+
+	// Velocities from the current state rather than the body transforms of the last step, so a restored checkpoint places the
+	// same spawns
+	std::vector<float> travel(spawnedObjects, 0.f);
+	float maxTravel = 0.f;
+
+	for (unsigned int body = 0; body < spawnedObjects; body++) {
+		if (sleepingBodies[body] == BODY_DESPAWNED) continue;
+
+		float q[4], quaternion[4], rotation[9], inverseInertia[9], angularMomentum[3], angularVelocity[3];
+		for (int c = 0; c < 4; c++) q[c] = rigidBodies.quaternion(c)[body];
+		for (int c = 0; c < 3; c++) angularMomentum[c] = rigidBodies.angularMomentum(c)[body];
+
+		normalizeQuaternion(q, quaternion);
+		quaternion2rotation(quaternion, rotation);
+		worldInverseInertia(rotation, bodyTypes.getType(types[body]).invInertiaTensor, inverseInertia);
+		multiplyVector(inverseInertia, angularMomentum, angularVelocity);
+
+		float speed = 0.f, angularSpeed = 0.f;
+		for (int c = 0; c < 3; c++) {
+			float velocity = rigidBodies.linearMomentum(c)[body] / bodyMass(body);
+			speed += velocity * velocity;
+			angularSpeed += angularVelocity[c] * angularVelocity[c];
+		}
+		travel[body] = (std::sqrt(speed) + std::sqrt(angularSpeed) * bodyTypes.getType(types[body]).radius) * deltaT;
+		maxTravel = std::max(maxTravel, travel[body]);
+	}
+
+	// The Verlet integrator derives the velocity from the position of the last step
+	float stepLength = lastDeltaT > 0.f ? lastDeltaT : deltaT;
+
+	float maxExtent = 0.f;
+	for (int type = 0; type < bodyTypes.getNumTypes(); type++) maxExtent = std::max(maxExtent, bodyTypes.getType(type).radius);
+	maxExtent += parameters.particleDiameter / 2.f;
+
+	// Bounding spheres of the placed bodies hashed by cells of the largest diameter, so only the 27 neighbouring cells can overlap
+	float cellLength = 2.f * maxExtent;
+	std::unordered_map<unsigned long long, std::vector<unsigned int> > placedCells;
+
+	auto sphereCell = [&](float const * position, int * cell) {
+		for (int c = 0; c < 3; c++) cell[c] = int(std::floor(position[c] / cellLength));
+	};
+	auto placeSphere = [&](unsigned int body) {
+		float position[3];
+		int cell[3];
+		for (int c = 0; c < 3; c++) position[c] = rigidBodies.position(c)[body];
+		sphereCell(position, cell);
+		placedCells[voxelKey(cell[0], cell[1], cell[2])].push_back(body);
+	};
+
+	// Before the first grid pass the bodies in use are only known by their spheres
+	if (cellStart.empty()) {
+		for (unsigned int body = 0; body < spawnedObjects; body++) {
+			if (sleepingBodies[body] != BODY_DESPAWNED) placeSphere(body);
+		}
+	}
+
+	int numAttempts = std::max(parameters.spawnAttempts, 1);
+
+	for (int emitter = 0; emitter < emitters.getNumEmitters(); emitter++) {
+
+		int fixedType = emitters.getEmitter(emitter).type;
+		bool sequence = fixedType < 0 || fixedType >= bodyTypes.getNumTypes();
+
+		while (emitters.getPendingSpawns(emitter) > 0 && getLiveObjects() <= (unsigned int)parameters.numRigidBodies) {
+
+			unsigned int type = sequence ? bodyTypes.getSpawnType(spawnCount) : unsigned(fixedType);
+			float extent = bodyTypes.getType(type).radius + parameters.particleDiameter / 2.f;
+
+			float position[3], velocity[3];
+			bool placed = false;
+
+			for (int attempt = 0; attempt < numAttempts && !placed; attempt++) {
+				emitters.drawCandidate(emitter, position, velocity);
+				placed = spawnPositionFree(position, extent, travel, maxTravel);
+
+				int cell[3];
+				sphereCell(position, cell);
+
+				for (int i = -1; i < 2 && placed; i++) {
+					for (int j = -1; j < 2 && placed; j++) {
+						for (int k = -1; k < 2 && placed; k++) {
+
+							auto bucket = placedCells.find(voxelKey(cell[0] + i, cell[1] + j, cell[2] + k));
+							if (bucket == placedCells.end()) continue;
+
+							for (size_t idx = 0; idx < bucket->second.size() && placed; idx++) {
+								unsigned int other = bucket->second[idx];
+								float otherExtent = bodyTypes.getType(types[other]).radius + parameters.particleDiameter / 2.f;
+								float distance2 = 0.f;
+								for (int c = 0; c < 3; c++) {
+									float delta = position[c] - rigidBodies.position(c)[other];
+									distance2 += delta * delta;
+								}
+								placed = distance2 >= (extent + otherExtent) * (extent + otherExtent);
+							}
+						}
+					}
+				}
+			}
+
+			// The emitter is blocked for this step
+			if (!placed) break;
+
+			if (sequence) spawnCount++;
+			emitters.spawned(emitter);
+
+			int body = spawnBody(type);
+			initializeBodies(body, body + 1);
+
+			float mass = bodyMass(body);
+			for (int c = 0; c < 3; c++) {
+				rigidBodies.position(c)[body] = position[c];
+				rigidBodies.nextPosition(c)[body] = parameters.integrator == IntegratorVerlet ? position[c] - velocity[c] * stepLength : position[c];
+				rigidBodies.linearMomentum(c)[body] += velocity[c] * mass;
+			}
+
+			placeSphere(unsigned(body));
+		}
+	}
+
+	return true;
+}
+
+/**
+* @brief Despawns the bodies which left the grid bounds with all of their particles or outlived bodyLifetime. Their slots go on the
+* free list, the next spawns recycle them
+*/
+bool CpuSolver::despawnPass(float deltaT)
+{
+	std::vector<unsigned int> const & types = bodyTypes.getBodyTypes();
+
+	bodyAges.resize(spawnedObjects, 0.f);
+
+	for (unsigned int body = 0; body < spawnedObjects; body++) {
+
+		if (sleepingBodies[body] == BODY_DESPAWNED) continue;
+
+		bodyAges[body] += deltaT;
+		bool despawn = parameters.bodyLifetime > 0.f && bodyAges[body] > parameters.bodyLifetime;
+
+		if (parameters.despawnOutsideGrid) {
+			float margin = bodyTypes.getType(types[body]).radius + parameters.particleDiameter / 2.f;
+			for (int c = 0; c < 3; c++) {
+				float position = rigidBodies.position(c)[body];
+				despawn = despawn || position < btmLeftFrontCorner[c] - margin || position > topRightBackCorner[c] + margin;
+			}
+		}
+
+		if (!despawn) continue;
+
+		sleepingBodies[body] = BODY_DESPAWNED;
+		for (int c = 0; c < 3; c++) {
+			rigidBodies.linearMomentum(c)[body] = 0.f;
+			rigidBodies.angularMomentum(c)[body] = 0.f;
+		}
+		freeBodies[types[body]].push_back(body);
+		numFreeBodies++;
+	}
+
+	return true;
+}
+
+/**
+* @brief Moves the bodies at the end of the bodies in use into the slots of despawned bodies, so the passes only run over live
+* bodies again. The particle ranges are laid out anew for the moved types, the particles of all bodies are written by the next step
+*/
+bool CpuSolver::compactBodies(void)
+{
+	std::vector<unsigned int> holes;
+	for (size_t type = 0; type < freeBodies.size(); type++) {
+		holes.insert(holes.end(), freeBodies[type].begin(), freeBodies[type].end());
+		freeBodies[type].clear();
+	}
+	std::sort(holes.begin(), holes.end());
+	bodyAges.resize(spawnedObjects, 0.f);
+
+	int last = int(spawnedObjects) - 1;
+	unsigned int numMoved = 0u;
+
+	for (size_t i = 0; i < holes.size(); i++) {
+
+		// The last body in use which is alive
+		while (last >= 0 && sleepingBodies[last] == BODY_DESPAWNED) last--;
+
+		int hole = int(holes[i]);
+		if (hole >= last) break;
+
+		for (int c = 0; c < 4; c++) {
+			rigidBodies.position(c)[hole] = rigidBodies.position(c)[last];
+			rigidBodies.nextPosition(c)[hole] = rigidBodies.nextPosition(c)[last];
+			rigidBodies.quaternion(c)[hole] = rigidBodies.quaternion(c)[last];
+			rigidBodies.nextQuaternion(c)[hole] = rigidBodies.nextQuaternion(c)[last];
+		}
+		for (int c = 0; c < 3; c++) {
+			rigidBodies.linearMomentum(c)[hole] = rigidBodies.linearMomentum(c)[last];
+			rigidBodies.angularMomentum(c)[hole] = rigidBodies.angularMomentum(c)[last];
+		}
+
+		bodyTypes.setBodyType(hole, bodyTypes.getBodyTypes()[last]);
+		sleepingBodies[hole] = sleepingBodies[last];
+		restingSteps[hole] = restingSteps[last];
+		bodyAges[hole] = bodyAges[last];
+		sleepingBodies[last] = BODY_DESPAWNED;
+		numMoved++;
+	}
+	if (numMoved > 0u) bodyLayout++;
+
+	while (last >= 0 && sleepingBodies[last] == BODY_DESPAWNED) last--;
+
+	spawnedObjects = unsigned(last + 1);
+	numFreeBodies = 0u;
+	sleepingBodies.resize(spawnedObjects);
+	restingSteps.resize(spawnedObjects);
+	bodyAges.resize(spawnedObjects);
+
+	// New particle ids - the slots start in id order and sleeping bodies write their particles into them
+	layoutBodies();
+
+	int numParticles = getNumParticles();
+	particleSlots.resize(numParticles);
+	slotParticles.resize(numParticles);
+	for (int particleID = 0; particleID < numParticles; particleID++) {
+		particleSlots[particleID] = unsigned(particleID);
+		slotParticles[particleID] = unsigned(particleID);
+	}
+
+	std::replace(sleepingBodies.begin(), sleepingBodies.end(), BODY_ASLEEP, BODY_FALLING_ASLEEP);
+	broadPhase.clear();
+
+	return true;
+}
+
+/**
+* @brief Calculates a 64 bit FNV-1a hash over the bit patterns of the positions, quaternions and momenta of the rigid bodies.
+* Two runs diverged if the checksums of the same step differ
+*/
+unsigned long long CpuSolver::computeStateChecksum(void) const
+{
+	unsigned long long hash = 14695981039346656037ull;
+	hash = (hash ^ spawnedObjects) * 1099511628211ull;
+
+	for (int c = 0; c < 4; c++) {
+		hash = hashFloats(hash, rigidBodies.position(c).data, spawnedObjects);
+		hash = hashFloats(hash, rigidBodies.quaternion(c).data, spawnedObjects);
+	}
+	for (int c = 0; c < 3; c++) {
+		hash = hashFloats(hash, rigidBodies.linearMomentum(c).data, spawnedObjects);
+		hash = hashFloats(hash, rigidBodies.angularMomentum(c).data, spawnedObjects);
+	}
+
+	return hash;
+}
+
+/** @brief Returns the checksum of the state after the last step. Only calculated in deterministic mode, 0 otherwise
+*/
+unsigned long long CpuSolver::getStateChecksum(void) const
+{
+	return stateChecksum;
+}
+
+/**
+* @brief Advances the simulation by frameTime seconds in steps of getTimeStep(), the counterpart of the substeps of
+* RigidSolver::Render(). Time which does not fill a whole step is kept for the next call. Returns the number of steps
+* @param frameTime		Elapsed time in seconds, e.g. the wall clock time of the last frame
+*/
+int CpuSolver::advance(float frameTime)
+{
+	int maxSubsteps = std::max(parameters.maxSubsteps, 1);
+	int substeps = 0;
+
+	accumulatedTime += frameTime;
+
+	while (substeps < maxSubsteps) {
+		float deltaT = getTimeStep();
+		if (deltaT <= 0.f || accumulatedTime < deltaT || !step(deltaT)) break;
+
+		accumulatedTime -= deltaT;
+		substeps++;
+	}
+
+	// Time which could not be caught up is dropped, otherwise every call would fall further behind
+	float deltaT = getTimeStep();
+	if (substeps == maxSubsteps && deltaT > 0.f && accumulatedTime >= deltaT) accumulatedTime = std::fmod(accumulatedTime, deltaT);
+
+	return substeps;
+}
+
+/**
+* @brief Runs the simulation for the given number of steps or seconds of simulated time in one go, e.g. to settle a pile before an
+* experiment. Unlike advance() there is no wall clock, substep limit or dropped time, the steps follow each other as fast as the
+* passes run. Returns the progress after the last step
+*/
+FastForwardProgress CpuSolver::fastForward(FastForwardOptions const & options)
+{
+	FastForwardProgress progress;
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+	bool bySteps = options.numSteps > 0;
+	double simulatedTime = 0.0; // Sums of many steps drift in single precision
+
+	bool running = bySteps || options.simulatedTime > 0.f;
+
+	while (running) {
+		float deltaT = getTimeStep();
+
+		// The last step ends on the requested time, a remainder below a thousandth of a step is dropped
+		if (!bySteps) deltaT = float(std::min(double(deltaT), double(options.simulatedTime) - simulatedTime));
+		if (deltaT <= 0.f || !step(deltaT)) break;
+
+		simulatedTime += deltaT;
+		progress.steps++;
+		progress.simulatedTime = float(simulatedTime);
+		progress.fraction = bySteps ? float(progress.steps) / float(options.numSteps) : std::min(float(simulatedTime / options.simulatedTime), 1.f);
+
+		bool done = bySteps ? progress.steps >= options.numSteps : options.simulatedTime - simulatedTime <= getTimeStep() * 1e-3;
+		bool report = done || (options.progressInterval > 0 && progress.steps % options.progressInterval == 0);
+		running = !done;
+
+		if (report && options.progress) {
+			progress.wallTime = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+			progress.liveObjects = getLiveObjects();
+			running = options.progress(progress) && running;
+		}
+	}
+
+	if (!options.checkpointPath.empty()) progress.checkpointSaved = saveCheckpoint(options.checkpointPath);
+
+	progress.wallTime = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	progress.liveObjects = getLiveObjects();
+
+	return progress;
+}
+
+/**
+* @brief Writes the state of the simulation to a checkpoint: both buffers and the momenta of the bodies, the body pool, the body
+* types, the spawn and time step state, the emitters, the particle streams sleeping bodies keep and the collision grid the next
+* spawns are placed with. The parameters besides the grid, the particle diameter and the integrator are not part of it
+*/
+bool CpuSolver::saveCheckpoint(std::string const & path) const
+{
+	CheckpointWriter writer;
+	if (!writer.open(path)) return false;
+
+	// The grid may refer to slots behind the particles of the bodies in use, e.g. after a compaction
+	size_t numSlots = std::min(std::max(slotParticles.size(), cellParticles.size()), particles.size());
+
+	CheckpointSolverState state;
+	std::memset(&state, 0, sizeof(state));
+	state.spawnedObjects = spawnedObjects;
+	state.capacity = unsigned(capacity);
+	state.numSlots = unsigned(numSlots);
+	state.stepCount = stepCount;
+	state.spawnCount = spawnCount;
+	state.timeSinceSpawn = timeSinceSpawn;
+	state.accumulatedTime = accumulatedTime;
+	state.lastDeltaT = lastDeltaT;
+	state.nextTimeStep = nextTimeStep;
+	state.stateChecksum[0] = unsigned(stateChecksum & 0xFFFFFFFFull);
+	state.stateChecksum[1] = unsigned(stateChecksum >> 32);
+	for (int c = 0; c < 3; c++) {
+		state.btmLeftFrontCorner[c] = btmLeftFrontCorner[c];
+		state.topRightBackCorner[c] = topRightBackCorner[c];
+		state.emitterPosition[c] = emitterPosition[c];
+	}
+	state.voxelLength = voxelLength;
+	state.particleDiameter = parameters.particleDiameter;
+	state.gridType = int(parameters.gridType);
+	state.integrator = int(parameters.integrator);
+	writer.write(CheckpointSolver, &state, 1);
+
+	// Body types and their templates
+	std::vector<CheckpointBodyType> types(bodyTypes.getNumTypes());
+	size_t numTemplateParticles = 0;
+	for (int type = 0; type < bodyTypes.getNumTypes(); type++) {
+		BodyType const & bodyType = bodyTypes.getType(type);
+		types[type].numParticles = bodyType.numParticles;
+		types[type].mass = bodyType.mass;
+		types[type].radius = bodyType.radius;
+		std::copy(bodyType.invInertiaTensor, bodyType.invInertiaTensor + 9, types[type].invInertiaTensor);
+		numTemplateParticles += size_t(bodyType.numParticles);
+	}
+	writer.write(CheckpointTypes, types.data(), types.size());
+	for (int c = 0; c < 3; c++) writer.write(CheckpointTemplate + c, bodyTypes.getTemplate(c), numTemplateParticles);
+	writer.write(CheckpointSpawnTypes, bodyTypes.getSpawnTypes().data(), bodyTypes.getSpawnTypes().size());
+	writer.write(CheckpointBodyTypes, bodyTypes.getBodyTypes().data(), size_t(capacity));
+
+	// Bodies
+	for (int c = 0; c < 4; c++) {
+		writer.write(CheckpointPosition + c, rigidBodies.position(c).data, spawnedObjects);
+		writer.write(CheckpointNextPosition + c, rigidBodies.nextPosition(c).data, spawnedObjects);
+		writer.write(CheckpointQuaternion + c, rigidBodies.quaternion(c).data, spawnedObjects);
+		writer.write(CheckpointNextQuaternion + c, rigidBodies.nextQuaternion(c).data, spawnedObjects);
+	}
+	for (int c = 0; c < 3; c++) {
+		writer.write(CheckpointLinearMomentum + c, rigidBodies.linearMomentum(c).data, spawnedObjects);
+		writer.write(CheckpointAngularMomentum + c, rigidBodies.angularMomentum(c).data, spawnedObjects);
+	}
+
+	// Bodies spawned since the last step have no sleep state yet
+	std::vector<unsigned char> sleepStates(sleepingBodies);
+	std::vector<unsigned int> resting(restingSteps);
+	std::vector<float> ages(bodyAges);
+	sleepStates.resize(spawnedObjects, BODY_AWAKE);
+	resting.resize(spawnedObjects, 0u);
+	ages.resize(spawnedObjects, 0.f);
+	writer.write(CheckpointSleepStates, sleepStates.data(), sleepStates.size());
+	writer.write(CheckpointRestingSteps, resting.data(), resting.size());
+	writer.write(CheckpointBodyAges, ages.data(), ages.size());
+
+	std::vector<unsigned int> freeTypes, freeList;
+	for (size_t type = 0; type < freeBodies.size(); type++) {
+		freeTypes.insert(freeTypes.end(), freeBodies[type].size(), unsigned(type));
+		freeList.insert(freeList.end(), freeBodies[type].begin(), freeBodies[type].end());
+	}
+	writer.write(CheckpointFreeBodyTypes, freeTypes.data(), freeTypes.size());
+	writer.write(CheckpointFreeBodies, freeList.data(), freeList.size());
+
+	// Particles and grid
+	writer.write(CheckpointSlotParticles, slotParticles.data(), slotParticles.size());
+	for (int c = 0; c < 3; c++) {
+		writer.write(CheckpointParticlePosition + c, particles.position(c).data, numSlots);
+		writer.write(CheckpointParticleVelocity + c, particles.velocity(c).data, numSlots);
+	}
+	writer.write(CheckpointParticleBody, particles.body().data, numSlots);
+	writer.write(CheckpointCellStart, cellStart.data(), cellStart.size());
+	writer.write(CheckpointCellParticles, cellParticles.data(), cellParticles.size());
+	if (parameters.gridType == CollisionGridHashed) writer.write(CheckpointParticleVoxels, particleVoxels.data(), particleVoxels.size());
+
+	// Emitters
+	std::vector<CheckpointEmitter> emitterStates(emitters.getNumEmitters());
+	for (int emitter = 0; emitter < emitters.getNumEmitters(); emitter++) {
+		Emitter const & settings = emitters.getEmitter(emitter);
+		EmitterState const & emitterState = emitters.getState(emitter);
+		CheckpointEmitter & out = emitterStates[emitter];
+
+		std::memset(&out, 0, sizeof(out));
+		for (int c = 0; c < 3; c++) {
+			out.position[c] = settings.position[c];
+			out.extent[c] = settings.extent[c];
+			out.velocity[c] = settings.velocity[c];
+		}
+		out.rate = settings.rate;
+		out.coneAngle = settings.coneAngle;
+		out.speedVariation = settings.speedVariation;
+		out.type = settings.type;
+		out.enabled = settings.enabled ? 1u : 0u;
+		out.seed = settings.seed;
+		out.rateSpawns = emitterState.rateSpawns;
+		out.rateCredit = emitterState.rateCredit;
+		out.burstSpawns = emitterState.burstSpawns;
+		out.random[0] = unsigned(emitterState.random & 0xFFFFFFFFull);
+		out.random[1] = unsigned(emitterState.random >> 32);
+	}
+	writer.write(CheckpointEmitters, emitterStates.data(), emitterStates.size());
+
+	return writer.close();
+}
+
+/**
+* @brief Replaces the simulation by the one of a checkpoint written by saveCheckpoint(). The file is mapped and each section is
+* copied into its state stream in one go. The next steps continue the saved run bit for bit if the other parameters, the thread
+* count in non-deterministic mode and the contact kernel are the same. Returns false, leaving the solver untouched, if the file
+* is no valid checkpoint
+*/
+bool CpuSolver::loadCheckpoint(std::string const & path)
+{
+	CheckpointReader reader;
+	if (!reader.open(path)) return false;
+
+	CheckpointSolverState state;
+	if (!reader.read(CheckpointSolver, &state, 1)) return false;
+
+	size_t numBodies = state.spawnedObjects;
+	size_t numSlots = state.numSlots;
+	if (numBodies == 0 || state.capacity < numBodies || state.gridType < 0 || state.gridType > CollisionGridHashed) return false;
+	if (state.integrator < 0 || state.integrator > IntegratorRK4) return false;
+
+	// The capacity sizes the layout and the body storage, a corrupt one must not allocate them
+	if (state.capacity > CHECKPOINT_MAX_BODIES || reader.count(CheckpointBodyTypes) != state.capacity) return false;
+
+	// Types and templates
+	std::vector<CheckpointBodyType> types(reader.count(CheckpointTypes));
+	if (types.empty() || !reader.read(CheckpointTypes, types.data(), types.size())) return false;
+
+	size_t numTemplateParticles = 0;
+	for (size_t type = 0; type < types.size(); type++) {
+		if (types[type].numParticles <= 0) return false;
+		numTemplateParticles += size_t(types[type].numParticles);
+	}
+
+	std::vector<float> templates[3];
+	for (int c = 0; c < 3; c++) {
+		templates[c].resize(numTemplateParticles);
+		if (!reader.read(CheckpointTemplate + c, templates[c].data(), numTemplateParticles)) return false;
+	}
+
+	std::vector<int> spawnTypes(reader.count(CheckpointSpawnTypes));
+	std::vector<unsigned int> layoutTypes(state.capacity);
+	if (!reader.read(CheckpointSpawnTypes, spawnTypes.data(), spawnTypes.size())) return false;
+	if (!reader.read(CheckpointBodyTypes, layoutTypes.data(), layoutTypes.size())) return false;
+
+	size_t numParticles = 0, numLayoutParticles = 0;
+	for (size_t type = 0; type < spawnTypes.size(); type++) {
+		if (spawnTypes[type] < 0 || size_t(spawnTypes[type]) >= types.size()) return false;
+	}
+	for (size_t body = 0; body < layoutTypes.size(); body++) {
+		if (layoutTypes[body] >= types.size()) return false;
+		numLayoutParticles += size_t(types[layoutTypes[body]].numParticles);
+		if (body + 1 == numBodies) numParticles = numLayoutParticles;
+	}
+
+	// The body and particle streams are copied straight into the state after it is resized, so they are only checked up front
+	bool complete = true;
+	for (int c = 0; c < 4; c++) {
+		complete = complete && reader.has<float>(CheckpointPosition + c, numBodies) && reader.has<float>(CheckpointNextPosition + c, numBodies)
+			&& reader.has<float>(CheckpointQuaternion + c, numBodies) && reader.has<float>(CheckpointNextQuaternion + c, numBodies);
+	}
+	for (int c = 0; c < 3; c++) {
+		complete = complete && reader.has<float>(CheckpointLinearMomentum + c, numBodies) && reader.has<float>(CheckpointAngularMomentum + c, numBodies)
+			&& reader.has<float>(CheckpointParticlePosition + c, numSlots) && reader.has<float>(CheckpointParticleVelocity + c, numSlots);
+	}
+	complete = complete && reader.has<unsigned char>(CheckpointSleepStates, numBodies) && reader.has<unsigned int>(CheckpointRestingSteps, numBodies)
+		&& reader.has<float>(CheckpointBodyAges, numBodies) && reader.has<unsigned int>(CheckpointParticleBody, numSlots);
+	if (!complete || numSlots > numLayoutParticles) return false;
+
+	std::vector<unsigned int> freeTypes(reader.count(CheckpointFreeBodyTypes)), freeList(freeTypes.size());
+	std::vector<unsigned int> slots(reader.count(CheckpointSlotParticles));
+	std::vector<unsigned int> grid(reader.count(CheckpointCellStart)), gridParticles(reader.count(CheckpointCellParticles));
+	std::vector<unsigned long long> voxels(reader.count(CheckpointParticleVoxels));
+	std::vector<CheckpointEmitter> emitterStates(reader.count(CheckpointEmitters));
+
+	if (!reader.read(CheckpointFreeBodyTypes, freeTypes.data(), freeTypes.size()) || !reader.read(CheckpointFreeBodies, freeList.data(), freeList.size())) return false;
+	if (!reader.read(CheckpointSlotParticles, slots.data(), slots.size()) || !reader.read(CheckpointCellStart, grid.data(), grid.size())) return false;
+	if (!reader.read(CheckpointCellParticles, gridParticles.data(), gridParticles.size())) return false;
+	if (!reader.read(CheckpointParticleVoxels, voxels.data(), voxels.size())) return false;
+	if (!reader.read(CheckpointEmitters, emitterStates.data(), emitterStates.size())) return false;
+
+	for (size_t entry = 0; entry < freeList.size(); entry++) {
+		if (freeTypes[entry] >= types.size() || freeList[entry] >= numBodies) return false;
+	}
+	if (slots.size() > numParticles || slots.size() > numSlots) return false;
+	for (size_t slot = 0; slot < slots.size(); slot++) {
+		if (slots[slot] >= slots.size()) return false;
+	}
+	if (gridParticles.size() > numSlots || (!grid.empty() && grid.back() > gridParticles.size())) return false;
+	if (state.gridType == CollisionGridHashed && !grid.empty() && voxels.size() < gridParticles.size()) return false;
+	for (size_t idx = 0; idx < (grid.empty() ? 0u : grid.back()); idx++) {
+		if (gridParticles[idx] >= numSlots) return false;
+	}
+
+	// Types, grid and the parameters the layout of the state depends on
+	bodyTypes.clear();
+	for (size_t type = 0, first = 0; type < types.size(); first += size_t(types[type].numParticles), type++) {
+		BodyType bodyType;
+		bodyType.firstParticle = 0;
+		bodyType.numParticles = types[type].numParticles;
+		bodyType.mass = types[type].mass;
+		bodyType.radius = types[type].radius;
+		std::copy(types[type].invInertiaTensor, types[type].invInertiaTensor + 9, bodyType.invInertiaTensor);
+		bodyTypes.restoreType(bodyType, templates[0].data() + first, templates[1].data() + first, templates[2].data() + first);
+	}
+	bodyTypes.setSpawnTypes(spawnTypes);
+
+	parameters.particleDiameter = state.particleDiameter;
+	parameters.gridType = CollisionGridType(state.gridType);
+	parameters.integrator = IntegratorType(state.integrator);
+	setGrid(state.btmLeftFrontCorner, state.topRightBackCorner, state.voxelLength);
+	setEmitterPosition(state.emitterPosition[0], state.emitterPosition[1], state.emitterPosition[2]);
+
+	// Storage and layout of the saved bodies
+	resetSimulation();
+	reserveBodies(int(state.capacity));
+	for (size_t body = 0; body < layoutTypes.size(); body++) bodyTypes.setBodyType(int(body), layoutTypes[body]);
+	layoutBodies();
+	spawnedObjects = state.spawnedObjects;
+
+	// Bodies
+	for (int c = 0; c < 4; c++) {
+		reader.read(CheckpointPosition + c, rigidBodies.position(c).data, numBodies);
+		reader.read(CheckpointNextPosition + c, rigidBodies.nextPosition(c).data, numBodies);
+		reader.read(CheckpointQuaternion + c, rigidBodies.quaternion(c).data, numBodies);
+		reader.read(CheckpointNextQuaternion + c, rigidBodies.nextQuaternion(c).data, numBodies);
+	}
+	for (int c = 0; c < 3; c++) {
+		reader.read(CheckpointLinearMomentum + c, rigidBodies.linearMomentum(c).data, numBodies);
+		reader.read(CheckpointAngularMomentum + c, rigidBodies.angularMomentum(c).data, numBodies);
+	}
+
+	sleepingBodies.resize(numBodies);
+	restingSteps.resize(numBodies);
+	bodyAges.resize(numBodies);
+	reader.read(CheckpointSleepStates, sleepingBodies.data(), numBodies);
+	reader.read(CheckpointRestingSteps, restingSteps.data(), numBodies);
+	reader.read(CheckpointBodyAges, bodyAges.data(), numBodies);
+
+	for (size_t entry = 0; entry < freeList.size(); entry++) freeBodies[freeTypes[entry]].push_back(freeList[entry]);
+	numFreeBodies = unsigned(freeList.size());
+
+	// Particles - slots without a particle of a body in use only serve the grid
+	slotParticles.swap(slots);
+	particleSlots.resize(slotParticles.size());
+	for (size_t slot = 0; slot < slotParticles.size(); slot++) particleSlots[slotParticles[slot]] = unsigned(slot);
+
+	for (int c = 0; c < 3; c++) {
+		reader.read(CheckpointParticlePosition + c, particles.position(c).data, numSlots);
+		reader.read(CheckpointParticleVelocity + c, particles.velocity(c).data, numSlots);
+	}
+	reader.read(CheckpointParticleBody, particles.body().data, numSlots);
+
+	// Collision grid of the last step - the histogram is allocated along with it and the next grid pass rebuilds it
+	if (!grid.empty()) {
+		resizeCells(int(grid.size()) - 1);
+		cellStart.swap(grid);
+	}
+	cellParticles.swap(gridParticles);
+	particleVoxels.swap(voxels);
+
+	// Emitters
+	std::vector<Emitter> restoredEmitters(emitterStates.size());
+	std::vector<EmitterState> restoredStates(emitterStates.size());
+	for (size_t emitter = 0; emitter < emitterStates.size(); emitter++) {
+		CheckpointEmitter const & in = emitterStates[emitter];
+		Emitter & settings = restoredEmitters[emitter];
+		EmitterState & emitterState = restoredStates[emitter];
+
+		for (int c = 0; c < 3; c++) {
+			settings.position[c] = in.position[c];
+			settings.extent[c] = in.extent[c];
+			settings.velocity[c] = in.velocity[c];
+		}
+		settings.rate = in.rate;
+		settings.coneAngle = in.coneAngle;
+		settings.speedVariation = in.speedVariation;
+		settings.type = in.type;
+		settings.enabled = in.enabled != 0u;
+		settings.seed = in.seed;
+		emitterState.rateSpawns = in.rateSpawns;
+		emitterState.rateCredit = in.rateCredit;
+		emitterState.burstSpawns = in.burstSpawns;
+		emitterState.random = (unsigned long long)(in.random[1]) << 32 | in.random[0];
+	}
+	emitters.restore(restoredEmitters, restoredStates);
+
+	// Counters and time step
+	stepCount = state.stepCount;
+	spawnCount = state.spawnCount;
+	timeSinceSpawn = state.timeSinceSpawn;
+	accumulatedTime = state.accumulatedTime;
+	lastDeltaT = state.lastDeltaT;
+	nextTimeStep = state.nextTimeStep;
+	stateChecksum = (unsigned long long)(state.stateChecksum[1]) << 32 | state.stateChecksum[0];
+
+	return true;
+}
+
+/**
+* @brief Hands the position and quaternion of every body in use to a trajectory recording, e.g. after each step. Despawned bodies
+* keep the pose they were despawned with. The frame carries getBodyLayout(), so the recording starts a new block whenever a body
+* index went to another body
+* @param time	Seconds of simulated time of the frame
+*/
+bool CpuSolver::writeTrajectoryFrame(TrajectoryWriter & writer, double time) const
+{
+	TrajectoryFrame frame;
+	frame.time = time;
+	frame.numBodies = spawnedObjects;
+	frame.layout = bodyLayout;
+	for (int c = 0; c < 3; c++) frame.position[c] = rigidBodies.position(c).data;
+	for (int c = 0; c < 4; c++) frame.quaternion[c] = rigidBodies.quaternion(c).data;
+
+	return writer.writeFrame(frame);
+}
+
+/**
+* @brief Returns the time step of the next step: the one picked by the time step controller if the time step is adaptive,
+* timeStep otherwise
+*/
+float CpuSolver::getTimeStep(void) const
+{
+	return parameters.adaptiveTimeStep ? nextTimeStep : parameters.timeStep;
+}
+
+/** @brief Returns the fastest particle of the last step in the adaptive mode - bounded by the speed of the body plus its spin
+*/
+float CpuSolver::getMaxParticleSpeed(void) const
+{
+	return maxParticleSpeed;
+}
+
+/** @brief Returns the deepest penetration of two particles or a particle and the ground plane of the last step
+*/
+float CpuSolver::getMaxOverlap(void) const
+{
+	return maxOverlap;
+}
+
+/**
+* @brief Returns the seconds of wall clock time the collision pass took since the reset - with fused stages the contact and
+* momenta stage
+*/
+double CpuSolver::getCollisionPassTime(void) const
+{
+	return collisionPassTime;
+}
+
+// --------------------------------------------------
+//  PASSES
+// --------------------------------------------------
+
+/**
+* @brief Runs the particle passes on the current rigid body state, which leaves the force and torque of each body in the rigid
+* body state. The Runge-Kutta integrators run it once per stage
+*/
+bool CpuSolver::evaluateForces(void)
+{
+	bodyTransformPass();
+	if (parameters.broadPhase || parameters.sleeping) broadPhasePass();
+
+	// The contact forces are timed on their own, e.g. to measure how they scale with the threads
+	std::chrono::steady_clock::time_point start;
+
+	if (parameters.fusedParticleStage) {
+		fusedParticleGridStage();
+		start = std::chrono::steady_clock::now();
+		fusedContactMomentaStage();
+		collisionPassTime += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	}
+	else {
+		particleValuePass();
+		collisionGridPass();
+		start = std::chrono::steady_clock::now();
+		collisionPass();
+		collisionPassTime += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		momentaPass();
+	}
+
+	return true;
+}
+
+/**
+* @brief Sorts the particles along the Z-order curve of their voxels so the candidates of the collision pass are close to
+* each other in memory. Uses the positions of the previous step, particleValuePass() writes the new state in the new order
+*/
+bool CpuSolver::reorderParticles(void)
+{
+	float const * positionX = particles.position(ComponentX).data;
+	float const * positionY = particles.position(ComponentY).data;
+	float const * positionZ = particles.position(ComponentZ).data;
+
+	int numParticles = int(slotParticles.size());
+
+	// Key and particle id - the id breaks ties so the order is deterministic
+	std::vector<std::pair<unsigned long long, unsigned int> > keys(numParticles);
+
+	threadPool.parallelFor(0, numParticles, PARTICLE_BLOCK_SIZE, [&](int begin, int end, int) {
+		for (int slot = begin; slot < end; slot++) {
+
+			int voxel[3];
+			voxelCoordinates(positionX[slot], positionY[slot], positionZ[slot], voxel);
+
+			// Particles outside of the dense grid go to the back, the hashed grid has no bounds
+			bool inside = true;
+			for (int i = 0; i < 3; i++) inside = inside && voxel[i] >= 0 && voxel[i] < gridResolution[i];
+
+			if (parameters.gridType == CollisionGridHashed) {
+				const int offset = 1 << 20;
+				keys[slot].first = mortonKey(voxel[0] + offset, voxel[1] + offset, voxel[2] + offset);
+			}
+			else {
+				keys[slot].first = inside ? mortonKey(voxel[0], voxel[1], voxel[2]) : ~0ull;
+			}
+			keys[slot].second = slotParticles[slot];
+		}
+	});
+
+	std::sort(keys.begin(), keys.end());
+
+	for (int slot = 0; slot < numParticles; slot++) {
+		slotParticles[slot] = keys[slot].second;
+		particleSlots[keys[slot].second] = slot;
+	}
+
+	// Sleeping bodies write their particles into the new slots
+	for (size_t body = 0; body < sleepingBodies.size(); body++) {
+		if (sleepingBodies[body] == BODY_ASLEEP) sleepingBodies[body] = BODY_FALLING_ASLEEP;
+	}
+
+	return true;
+}
+
+/**
+* @brief Calculates the rotation matrix, the world space inverse inertia tensor and the velocities of every rigid body once,
+* instead of once per particle like particleValues.frag and once more in solver.frag
+*/
+bool CpuSolver::bodyTransformPass(void)
+{
+	bodyTransforms.resize(spawnedObjects);
+
+	std::vector<unsigned int> const & types = bodyTypes.getBodyTypes();
+
+	threadPool.parallelFor(0, int(spawnedObjects), PARTICLE_BLOCK_SIZE, [&](int begin, int end, int) {
+		for (int body = begin; body < end; body++) {
+
+			BodyTransform & transform = bodyTransforms[body];
+			float q[4], quaternion[4], angularMomentum[3];
+			float mass = bodyMass(body);
+
+			for (int c = 0; c < 4; c++) q[c] = rigidBodies.quaternion(c)[body];
+			for (int c = 0; c < 3; c++) {
+				angularMomentum[c] = rigidBodies.angularMomentum(c)[body];
+				transform.velocity[c] = rigidBodies.linearMomentum(c)[body] / mass;
+			}
+
+			normalizeQuaternion(q, quaternion);
+			quaternion2rotation(quaternion, transform.rotation);
+			worldInverseInertia(transform.rotation, bodyTypes.getType(types[body]).invInertiaTensor, transform.inverseInertia);
+			multiplyVector(transform.inverseInertia, angularMomentum, transform.angularVelocity);
+		}
+	});
+
+	return true;
+}
+
+/**
+* @brief Counterpart of particleValues.frag: calculates the particle positions, velocities and relative positions
+* from the rigid body position, quaternion and momenta
+*/
+bool CpuSolver::particleValuePass(void)
+{
+	float * positionX = particles.position(ComponentX).data;
+	float * positionY = particles.position(ComponentY).data;
+	float * positionZ = particles.position(ComponentZ).data;
+	float * velocityX = particles.velocity(ComponentX).data;
+	float * velocityY = particles.velocity(ComponentY).data;
+	float * velocityZ = particles.velocity(ComponentZ).data;
+	float * relativeX = particles.relativePosition(ComponentX).data;
+	float * relativeY = particles.relativePosition(ComponentY).data;
+	float * relativeZ = particles.relativePosition(ComponentZ).data;
+	unsigned int * bodies = particles.body().data;
+
+	std::vector<unsigned int> const & types = bodyTypes.getBodyTypes();
+	std::vector<unsigned int> const & bodyOffsets = bodyTypes.getBodyParticleOffsets();
+
+	// Every body writes the slots of its own particles - the bodies are spread over the threads in blocks of about
+	// PARTICLE_BLOCK_SIZE particles
+	threadPool.parallelFor(0, int(spawnedObjects), tasksPerBlock(int(spawnedObjects)), [&](int begin, int end, int) {
+		for (int body = begin; body < end; body++) {
+
+			// The particles of sleeping bodies did not move
+			if (sleepingBodies[body] == BODY_ASLEEP || sleepingBodies[body] == BODY_DESPAWNED) continue;
+
+			// Template of the type of this body
+			BodyType const & type = bodyTypes.getType(types[body]);
+			float const * templateX = bodyTypes.getTemplate(ComponentX) + type.firstParticle;
+			float const * templateY = bodyTypes.getTemplate(ComponentY) + type.firstParticle;
+			float const * templateZ = bodyTypes.getTemplate(ComponentZ) + type.firstParticle;
+
+			BodyTransform const & transform = bodyTransforms[body];
+			float const * rotation = transform.rotation;
+			float const * velocity = transform.velocity;
+			float const * angularVelocity = transform.angularVelocity;
+
+			float bodyPosition[3];
+			for (int c = 0; c < 3; c++) bodyPosition[c] = rigidBodies.position(c)[body];
+
+			// Streams over the particles of this body
+			int first = int(bodyOffsets[body]);
+
+			for (int particle = 0; particle < type.numParticles; particle++) {
+
+				unsigned int slot = particleSlots[first + particle];
+
+				float rx = rotation[0] * templateX[particle] + rotation[3] * templateY[particle] + rotation[6] * templateZ[particle];
+				float ry = rotation[1] * templateX[particle] + rotation[4] * templateY[particle] + rotation[7] * templateZ[particle];
+				float rz = rotation[2] * templateX[particle] + rotation[5] * templateY[particle] + rotation[8] * templateZ[particle];
+
+				relativeX[slot] = rx;
+				relativeY[slot] = ry;
+				relativeZ[slot] = rz;
+				bodies[slot] = body;
+
+				positionX[slot] = bodyPosition[0] + rx;
+				positionY[slot] = bodyPosition[1] + ry;
+				positionZ[slot] = bodyPosition[2] + rz;
+
+				velocityX[slot] = velocity[0] + (angularVelocity[1] * rz - angularVelocity[2] * ry);
+				velocityY[slot] = velocity[1] + (angularVelocity[2] * rx - angularVelocity[0] * rz);
+				velocityZ[slot] = velocity[2] + (angularVelocity[0] * ry - angularVelocity[1] * rx);
+			}
+		}
+	});
+
+	return true;
+}
+
+/**
+* @brief Sweep and prune over the bounding boxes of the rigid bodies. Two bodies can only touch if their centers are closer
+* than the sum of their model radii plus one particle diameter, which gives the half edge length of the boxes. Despawned bodies
+* get empty boxes until a spawn or compactBodies() reuses their slots, so they neither wake nor join the islands of live bodies
+*/
+bool CpuSolver::broadPhasePass(void)
+{
+	std::vector<unsigned int> const & types = bodyTypes.getBodyTypes();
+
+	bodyExtents.resize(spawnedObjects);
+	for (unsigned int body = 0; body < spawnedObjects; body++) {
+		if (sleepingBodies[body] == BODY_DESPAWNED) bodyExtents[body] = -std::numeric_limits<float>::infinity();
+		else bodyExtents[body] = bodyTypes.getType(types[body]).radius + parameters.particleDiameter / 2.f;
+	}
+
+	broadPhase.update(rigidBodies.position(ComponentX).data, rigidBodies.position(ComponentY).data, rigidBodies.position(ComponentZ).data,
+		bodyExtents.data(), int(spawnedObjects));
+
+	return true;
+}
+
+/**
+* @brief Counterpart of the collision grid pass. Builds the grid with a counting sort in one pass over the particles instead
+* of one draw per z slice and channel: a histogram of the particles per voxel, an exclusive prefix sum into cellStart and a
+* scatter of the particle ids into cellParticles. Voxels hold any number of particles. They are sorted by id only in
+* deterministic mode or on a single thread, otherwise they are in the order the threads scattered them
+*/
+bool CpuSolver::collisionGridPass(void)
+{
+	float const * positionX = particles.position(ComponentX).data;
+	float const * positionY = particles.position(ComponentY).data;
+	float const * positionZ = particles.position(ComponentZ).data;
+
+	int numParticles = getNumParticles();
+	int numCells = prepareCells();
+
+	// Particles of despawned bodies stay out of the grid
+	unsigned int const * particleBodies = bodyTypes.getParticleBodies().data();
+	bool despawned = numFreeBodies > 0u;
+
+	// Histogram
+	threadPool.parallelFor(0, numParticles, PARTICLE_BLOCK_SIZE, [&](int begin, int end, int) {
+		for (int particleID = begin; particleID < end; particleID++) {
+			if (despawned && sleepingBodies[particleBodies[slotParticles[particleID]]] == BODY_DESPAWNED) {
+				particleCells[particleID] = -1;
+				continue;
+			}
+			countParticle(particleID, positionX[particleID], positionY[particleID], positionZ[particleID], numCells);
+		}
+	});
+
+	buildCells(numCells);
+
+	return true;
+}
+
+/**
+* @brief Sizes the grid for the current particles and returns the number of cells
+*/
+int CpuSolver::prepareCells(void)
+{
+	int numParticles = getNumParticles();
+	bool hashed = parameters.gridType == CollisionGridHashed;
+
+	// Twice as many buckets as particles keeps the buckets short
+	int numCells = hashed ? nextPowerOfTwo(std::max(2 * numParticles, 64)) : gridResolution[0] * gridResolution[1] * gridResolution[2];
+	if (int(cellStart.size()) != numCells + 1) resizeCells(numCells);
+
+	particleCells.resize(numParticles);
+	cellParticles.resize(numParticles);
+	if (hashed) particleVoxels.resize(numParticles);
+
+	return numCells;
+}
+
+/**
+* @brief Adds the particle in the given slot to the histogram of the grid
+*/
+void CpuSolver::countParticle(int slot, float x, float y, float z, int numCells)
+{
+	int cell;
+	if (parameters.gridType == CollisionGridHashed) {
+		int voxel[3];
+		voxelCoordinates(x, y, z, voxel);
+		particleVoxels[slot] = voxelKey(voxel[0], voxel[1], voxel[2]);
+		cell = hashedCell(voxel[0], voxel[1], voxel[2], numCells);
+	}
+	else {
+		cell = voxelIndex(x, y, z);
+	}
+
+	particleCells[slot] = cell;
+	if (cell >= 0) cellCounts[cell].fetch_add(1u, std::memory_order_relaxed);
+}
+
+/**
+* @brief Turns the histogram into the cell ranges and scatters the particles into them
+*/
+void CpuSolver::buildCells(int numCells)
+{
+	int numParticles = getNumParticles();
+
+	// Exclusive prefix sum
+	unsigned int offset = 0u;
+	for (int cell = 0; cell < numCells; cell++) {
+		cellStart[cell] = offset;
+		offset += cellCounts[cell].load(std::memory_order_relaxed);
+	}
+	cellStart[numCells] = offset;
+
+	// Scatter - counting the histogram back down leaves it cleared for the next step
+	threadPool.parallelFor(0, numParticles, PARTICLE_BLOCK_SIZE, [&](int begin, int end, int) {
+		for (int particleID = begin; particleID < end; particleID++) {
+			int voxel = particleCells[particleID];
+			if (voxel >= 0) cellParticles[cellStart[voxel + 1] - cellCounts[voxel].fetch_sub(1u, std::memory_order_relaxed)] = particleID;
+		}
+	});
+
+	// A single thread scatters in id order. Otherwise the order depends on the scheduling of the threads, which changes
+	// the order the contact forces are added up in - deterministic mode sorts the few particles of each cell
+	bool sortCells = parameters.deterministic && threadPool.getNumThreads() > 1;
+
+	// Cells holding the particles of one body only are tagged with it, the collision pass skips them for that body
+	bool tagCells = !parameters.bodySelfContacts;
+	unsigned int const * bodies = particles.body().data;
+
+	// Blocks of whole cells, so every range of cellParticles is only touched by the thread which owns its cell
+	if (sortCells || tagCells) {
+		threadPool.parallelFor(0, numCells, tasksPerBlock(numCells), [&](int begin, int end, int) {
+			for (int cell = begin; cell < end; cell++) {
+
+				unsigned int first = cellStart[cell];
+				unsigned int last = cellStart[cell + 1];
+				if (first == last) continue;
+
+				if (sortCells && last - first > 1u) std::sort(cellParticles.begin() + first, cellParticles.begin() + last);
+
+				if (tagCells) {
+					unsigned int body = bodies[cellParticles[first]];
+					for (unsigned int other = first + 1; other < last && body != CELL_MIXED_BODIES; other++) {
+						if (bodies[cellParticles[other]] != body) body = CELL_MIXED_BODIES;
+					}
+					cellBodies[cell] = body;
+				}
+			}
+		});
+	}
+}
+
+/**
+* @brief Counterpart of collision.frag: applies gravity and calculates the forces inflicted by collisions with other particles
+* and the ground plane
+*/
+bool CpuSolver::collisionPass(void)
+{
+	ContactParticles contactParticles;
+	ContactParameters contactParameters;
+	contactSetup(contactParticles, contactParameters);
+
+	float * forceX = particles.force(ComponentX).data;
+	float * forceY = particles.force(ComponentY).data;
+	float * forceZ = particles.force(ComponentZ).data;
+
+	unsigned int const * particleBodies = bodyTypes.getParticleBodies().data();
+	int numParticles = getNumParticles();
+
+	// Every particle is independent - the blocks are spread over the threads
+	threadPool.parallelFor(0, numParticles, PARTICLE_BLOCK_SIZE, [&](int begin, int end, int thread) {
+
+		std::vector<unsigned int> candidates;
+		float overlap = 0.f;
+
+		for (int particleID = begin; particleID < end; particleID++) {
+
+			// Sleeping bodies only take part as the neighbours of the others
+			if (sleepingBodies[particleBodies[slotParticles[particleID]]] != BODY_AWAKE) continue;
+
+			float force[3];
+			contactForce(particleID, contactParticles, contactParameters, candidates, force, &overlap);
+
+			forceX[particleID] = force[0];
+			forceY[particleID] = force[1];
+			forceZ[particleID] = force[2];
+		}
+
+		threadOverlaps[thread] = std::max(threadOverlaps[thread], overlap);
+	});
+
+	return true;
+}
+
+/**
+* @brief Fills in the particle streams and coefficients the contact kernel works on and clears the deepest overlap of each thread
+*/
+void CpuSolver::contactSetup(ContactParticles & contactParticles, ContactParameters & contactParameters)
+{
+	threadOverlaps.assign(threadPool.getNumThreads(), 0.f);
+
+	contactParameters.springCoefficient = parameters.springCoefficient;
+	contactParameters.dampingCoefficient = parameters.dampingCoefficient;
+	contactParameters.particleDiameter = parameters.particleDiameter;
+
+	contactParticles.positionX = particles.position(ComponentX).data;
+	contactParticles.positionY = particles.position(ComponentY).data;
+	contactParticles.positionZ = particles.position(ComponentZ).data;
+	contactParticles.velocityX = particles.velocity(ComponentX).data;
+	contactParticles.velocityY = particles.velocity(ComponentY).data;
+	contactParticles.velocityZ = particles.velocity(ComponentZ).data;
+	contactParticles.body = parameters.bodySelfContacts ? NULL : particles.body().data;
+}
+
+/**
+* @brief Calculates the force on the particle in the given slot: gravity, the contacts with the particles of the 27 neighbouring
+* voxels and the ground plane
+* @param candidates		Scratch buffer of the calling thread
+* @param overlap		Raised to the deepest penetration of another particle or the ground plane
+*/
+void CpuSolver::contactForce(int slot, ContactParticles const & contactParticles, ContactParameters const & contactParameters,
+	std::vector<unsigned int> & candidates, float * force, float * overlap) const
+{
+	int numCells = int(cellStart.size()) - 1;
+	bool hashed = parameters.gridType == CollisionGridHashed;
+
+	// Cells holding only particles of the own body are skipped as a whole
+	bool skipOwnCells = !parameters.bodySelfContacts;
+
+	float position_i[3] = { contactParticles.positionX[slot], contactParticles.positionY[slot], contactParticles.positionZ[slot] };
+
+	unsigned int body = bodyTypes.getParticleBodies()[slotParticles[slot]];
+	int bodyParticles = bodyTypes.getType(bodyTypes.getBodyTypes()[body]).numParticles;
+
+	// Always apply gravity - the weight of the body is spread over its particles
+	force[0] = 0.f;
+	force[1] = -parameters.gravity * bodyMass(body) / bodyParticles;
+	force[2] = 0.f;
+
+	// Particles of bodies which do not overlap any other body have no contacts
+	bool isolated = parameters.broadPhase && !broadPhase.getActiveBodies()[body];
+
+	if (!isolated) {
+
+		int voxel[3];
+		voxelCoordinates(position_i[0], position_i[1], position_i[2], voxel);
+
+		// Gather the candidates of the neighbouring voxels
+		candidates.clear();
+
+		for (int i = -1; i < 2; i++) {
+			for (int j = -1; j < 2; j++) {
+				for (int k = -1; k < 2; k++) {
+
+					int x = voxel[0] + i, y = voxel[1] + j, z = voxel[2] + k;
+
+					if (hashed) {
+						// Skip the particles of other voxels in the same bucket
+						unsigned long long key = voxelKey(x, y, z);
+						int cell = hashedCell(x, y, z, numCells);
+						if (skipOwnCells && cellBodies[cell] == body) continue;
+
+						for (unsigned int idx = cellStart[cell]; idx < cellStart[cell + 1]; idx++) {
+							if (particleVoxels[cellParticles[idx]] == key) candidates.push_back(cellParticles[idx]);
+						}
+					}
+					else {
+						if (x < 0 || y < 0 || z < 0 || x >= gridResolution[0] || y >= gridResolution[1] || z >= gridResolution[2]) continue;
+
+						int cell = (z * gridResolution[1] + y) * gridResolution[0] + x;
+						if (skipOwnCells && cellBodies[cell] == body) continue;
+
+						candidates.insert(candidates.end(), cellParticles.begin() + cellStart[cell], cellParticles.begin() + cellStart[cell + 1]);
+					}
+				}
+			}
+		}
+
+		if (!candidates.empty()) contactKernel(contactParticles, slot, candidates.data(), int(candidates.size()), contactParameters, force, overlap);
+	}
+
+	// Determine floor collisions
+	if (position_i[1] < btmLeftFrontCorner[1]) {
+
+		*overlap = std::max(*overlap, btmLeftFrontCorner[1] - position_i[1]);
+
+		float velocity_i[3] = { contactParticles.velocityX[slot], contactParticles.velocityY[slot], contactParticles.velocityZ[slot] };
+
+		// The normal of the ground plane is (0, 1, 0)
+		for (int c = 0; c < 3; c++) {
+			float normal = c == 1 ? 1.f : 0.f;
+			float velocity = -velocity_i[c];
+
+			float forceSpring = -1.f * (parameters.dampingCoefficient + position_i[1]) * normal;
+			float forceDamp = parameters.particleDiameter * velocity;
+			float forceTangential = velocity - (velocity * normal) * normal;
+
+			force[c] += forceSpring + forceDamp + forceTangential;
+		}
+	}
+}
+
+/**
+* @brief Counterpart of momenta.frag: sums up the forces of the particles of each rigid body to its force and torque.
+* Small bodies are reduced one per thread in blocks of bodies. Bodies with LARGE_BODY_PARTICLES or more are split into blocks of
+* particles whose partial sums are combined in a fixed order afterwards, so large models do not end up on one thread
+*/
+bool CpuSolver::momentaPass(void)
+{
+	std::vector<unsigned int> const & bodyOffsets = bodyTypes.getBodyParticleOffsets();
+
+	int numBlocks = int(blockOffsets[spawnedObjects]);
+	partialMomenta.resize(size_t(numBlocks) * 6);
+
+	threadPool.parallelFor(0, numBlocks, tasksPerBlock(numBlocks), [&](int begin, int end, int) {
+		for (int block = begin; block < end; block++) {
+
+			// Sleeping bodies keep zero momenta - their sums are not used
+			unsigned int body = blockBodies[block];
+			if (sleepingBodies[body] != BODY_AWAKE) continue;
+
+			int numParticles = int(bodyOffsets[body + 1] - bodyOffsets[body]);
+
+			if (blockOffsets[body + 1] - blockOffsets[body] == 1u) {
+				float momenta[6];
+				sumMomenta(body, 0, numParticles, momenta);
+
+				for (int c = 0; c < 3; c++) {
+					rigidBodies.force(c)[body] = momenta[c];
+					rigidBodies.torque(c)[body] = momenta[3 + c];
+				}
+			}
+			else {
+				// Partial sum of a particle block
+				int first = int(block - blockOffsets[body]) * PARTICLE_BLOCK_SIZE;
+				sumMomenta(body, first, std::min(first + PARTICLE_BLOCK_SIZE, numParticles), &partialMomenta[size_t(block) * 6]);
+			}
+		}
+	});
+
+	if (largeBodies) combineMomenta();
+
+	return true;
+}
+
+/**
+* @brief Adds up the partial sums of the blocks of each large body in block order and writes force and torque
+*/
+void CpuSolver::combineMomenta(void)
+{
+	threadPool.parallelFor(0, int(spawnedObjects), PARTICLE_BLOCK_SIZE, [&](int begin, int end, int) {
+		for (int body = begin; body < end; body++) {
+
+			if (sleepingBodies[body] != BODY_AWAKE || blockOffsets[body + 1] - blockOffsets[body] == 1u) continue;
+
+			float momenta[6] = { 0.f, 0.f, 0.f, 0.f, 0.f, 0.f };
+			for (unsigned int block = blockOffsets[body]; block < blockOffsets[body + 1]; block++) {
+				for (int i = 0; i < 6; i++) momenta[i] += partialMomenta[size_t(block) * 6 + i];
+			}
+
+			for (int c = 0; c < 3; c++) {
+				rigidBodies.force(c)[body] = momenta[c];
+				rigidBodies.torque(c)[body] = momenta[3 + c];
+			}
+		}
+	});
+}
+
+/**
+* @brief Sums up the forces and torques of the particles [first, last) of a rigid body
+* @param momenta	Receives the linear (0 - 2) and the angular (3 - 5) sum
+*/
+void CpuSolver::sumMomenta(int body, int first, int last, float * momenta) const
+{
+	float const * forceX = particles.force(ComponentX).data;
+	float const * forceY = particles.force(ComponentY).data;
+	float const * forceZ = particles.force(ComponentZ).data;
+	float const * relativeX = particles.relativePosition(ComponentX).data;
+	float const * relativeY = particles.relativePosition(ComponentY).data;
+	float const * relativeZ = particles.relativePosition(ComponentZ).data;
+
+	float linearMomentum[3] = { 0.f, 0.f, 0.f };
+	float angularMomentum[3] = { 0.f, 0.f, 0.f };
+
+	int offset = int(bodyTypes.getBodyParticleOffsets()[body]);
+
+	for (int particleID = offset + first; particleID < offset + last; particleID++) {
+
+		unsigned int slot = particleSlots[particleID];
+
+		linearMomentum[0] += forceX[slot];
+		linearMomentum[1] += forceY[slot];
+		linearMomentum[2] += forceZ[slot];
+
+		angularMomentum[0] += relativeY[slot] * forceZ[slot] - relativeZ[slot] * forceY[slot];
+		angularMomentum[1] += relativeZ[slot] * forceX[slot] - relativeX[slot] * forceZ[slot];
+		angularMomentum[2] += relativeX[slot] * forceY[slot] - relativeY[slot] * forceX[slot];
+	}
+
+	for (int c = 0; c < 3; c++) {
+		momenta[c] = linearMomentum[c];
+		momenta[3 + c] = angularMomentum[c];
+	}
+}
+
+/**
+* @brief Counterpart of solver.frag: calculates the new momenta, positions and quaternions of the rigid bodies with the selected
+* integrator. Sleeping bodies keep their place
+*/
+bool CpuSolver::solverPass(float deltaT)
+{
+	for (int c = 0; c < 3; c++) {
+		bodyVelocities[c].resize(spawnedObjects);
+		bodyAngularVelocities[c].resize(spawnedObjects);
+	}
+
+	switch (parameters.integrator) {
+	case IntegratorVerlet: verletIntegration(deltaT); break;
+	case IntegratorRK2:
+	case IntegratorRK4: rungeKuttaIntegration(deltaT); break;
+	default: eulerIntegration(deltaT); break;
+	}
+
+	for (unsigned int body = 0; body < spawnedObjects; body++) {
+
+		// Sleeping bodies stay in place in both buffers
+		if (sleepingBodies[body] != BODY_AWAKE) {
+			for (int c = 0; c < 4; c++) {
+				rigidBodies.nextPosition(c)[body] = rigidBodies.position(c)[body];
+				rigidBodies.nextQuaternion(c)[body] = rigidBodies.quaternion(c)[body];
+			}
+		}
+
+		// The homogeneous coordinate stays 1
+		rigidBodies.nextPosition(ComponentW)[body] = 1.f;
+	}
+
+	lastDeltaT = deltaT;
+
+	return true;
+}
+
+/**
+* @brief Explicit Euler like solver.frag - the momenta are replaced by the impulse of the step - or semi-implicit Euler, which
+* adds the impulse to the momenta. Both move the bodies with the new momenta
+*/
+void CpuSolver::eulerIntegration(float deltaT)
+{
+	bool accumulate = parameters.integrator == IntegratorSemiImplicitEuler;
+
+	for (unsigned int body = 0; body < spawnedObjects; body++) {
+
+		if (sleepingBodies[body] != BODY_AWAKE) continue;
+
+		float angularMomentum[3], angularVelocity[3];
+		float mass = bodyMass(body);
+
+		for (int c = 0; c < 3; c++) {
+			float linearImpulse = rigidBodies.force(c)[body] * deltaT;
+			float angularImpulse = rigidBodies.torque(c)[body] * deltaT;
+
+			rigidBodies.linearMomentum(c)[body] = accumulate ? rigidBodies.linearMomentum(c)[body] + linearImpulse : linearImpulse;
+			rigidBodies.angularMomentum(c)[body] = accumulate ? rigidBodies.angularMomentum(c)[body] + angularImpulse : angularImpulse;
+
+			angularMomentum[c] = rigidBodies.angularMomentum(c)[body];
+			bodyVelocities[c][body] = rigidBodies.linearMomentum(c)[body] / mass;
+		}
+
+		// The quaternion did not change since bodyTransformPass(), the momenta did
+		multiplyVector(bodyTransforms[body].inverseInertia, angularMomentum, angularVelocity);
+		for (int c = 0; c < 3; c++) bodyAngularVelocities[c][body] = angularVelocity[c];
+	}
+
+	advanceBodies(integratorStreams(false), 0, int(spawnedObjects), deltaT);
+}
+
+/**
+* @brief Stoermer-Verlet: the new position follows from the current one, the one of the last step - still held by the back
+* buffer - and the acceleration. Steps of different length are scaled. The rotation is integrated like semi-implicit Euler
+*/
+void CpuSolver::verletIntegration(float deltaT)
+{
+	float stepRatio = lastDeltaT > 0.f ? deltaT / lastDeltaT : 1.f;
+
+	for (unsigned int body = 0; body < spawnedObjects; body++) {
+
+		if (sleepingBodies[body] != BODY_AWAKE) continue;
+
+		float angularMomentum[3], angularVelocity[3];
+		float mass = bodyMass(body);
+
+		for (int c = 0; c < 3; c++) {
+			float displacement = (rigidBodies.position(c)[body] - rigidBodies.nextPosition(c)[body]) * stepRatio
+				+ rigidBodies.force(c)[body] / mass * deltaT * deltaT;
+
+			bodyVelocities[c][body] = displacement / deltaT;
+			rigidBodies.linearMomentum(c)[body] = bodyVelocities[c][body] * mass;
+
+			rigidBodies.angularMomentum(c)[body] += rigidBodies.torque(c)[body] * deltaT;
+			angularMomentum[c] = rigidBodies.angularMomentum(c)[body];
+		}
+
+		multiplyVector(bodyTransforms[body].inverseInertia, angularMomentum, angularVelocity);
+		for (int c = 0; c < 3; c++) bodyAngularVelocities[c][body] = angularVelocity[c];
+	}
+
+	advanceBodies(integratorStreams(false), 0, int(spawnedObjects), deltaT);
+}
+
+/**
+* @brief Midpoint method (RK2) or classical Runge-Kutta (RK4) over positions, quaternions and momenta. step() evaluated the
+* forces of the first stage, the state of each further stage is written into the front buffer and the momenta before the particle
+* passes run on it. The quaternions follow the weighted angular velocity of the stages. The front buffer is restored afterwards
+*/
+void CpuSolver::rungeKuttaIntegration(float deltaT)
+{
+	static const float rk2Offsets[2] = { 0.f, .5f };
+	static const float rk2Weights[2] = { 0.f, 1.f };
+	static const float rk4Offsets[4] = { 0.f, .5f, .5f, 1.f };
+	static const float rk4Weights[4] = { 1.f / 6.f, 1.f / 3.f, 1.f / 3.f, 1.f / 6.f };
+
+	int stages = getIntegratorEvaluations(parameters.integrator);
+	float const * offsets = stages == 4 ? rk4Offsets : rk2Offsets;
+	float const * weights = stages == 4 ? rk4Weights : rk2Weights;
+
+	// State at the start of the step and the weighted sums of the stage derivatives
+	for (int c = 0; c < 4; c++) startQuaternions[c].resize(spawnedObjects);
+	for (int c = 0; c < 6; c++) startMomenta[c].resize(spawnedObjects);
+	for (int c = 0; c < 3; c++) startPositions[c].resize(spawnedObjects);
+	for (int c = 0; c < 12; c++) {
+		stageSums[c].resize(spawnedObjects);
+		stageSums[c].fill(0.f);
+	}
+
+	for (unsigned int body = 0; body < spawnedObjects; body++) {
+		for (int c = 0; c < 4; c++) startQuaternions[c][body] = rigidBodies.quaternion(c)[body];
+		for (int c = 0; c < 3; c++) {
+			startPositions[c][body] = rigidBodies.position(c)[body];
+			startMomenta[c][body] = rigidBodies.linearMomentum(c)[body];
+			startMomenta[3 + c][body] = rigidBodies.angularMomentum(c)[body];
+		}
+	}
+
+	for (int stage = 0; stage < stages; stage++) {
+
+		if (stage > 0) {
+			// State of this stage from the derivatives of the previous one
+			float stageDeltaT = offsets[stage] * deltaT;
+			advanceBodies(integratorStreams(true), 0, int(spawnedObjects), stageDeltaT);
+
+			for (unsigned int body = 0; body < spawnedObjects; body++) {
+				if (sleepingBodies[body] != BODY_AWAKE) continue;
+				for (int c = 0; c < 3; c++) {
+					rigidBodies.linearMomentum(c)[body] = startMomenta[c][body] + rigidBodies.force(c)[body] * stageDeltaT;
+					rigidBodies.angularMomentum(c)[body] = startMomenta[3 + c][body] + rigidBodies.torque(c)[body] * stageDeltaT;
+				}
+			}
+
+			evaluateForces();
+		}
+
+		// Derivatives of this stage - velocities at the stage state, forces of the particle passes
+		for (unsigned int body = 0; body < spawnedObjects; body++) {
+			BodyTransform const & transform = bodyTransforms[body];
+			for (int c = 0; c < 3; c++) {
+				bodyVelocities[c][body] = transform.velocity[c];
+				bodyAngularVelocities[c][body] = transform.angularVelocity[c];
+
+				stageSums[c][body] += weights[stage] * transform.velocity[c];
+				stageSums[3 + c][body] += weights[stage] * transform.angularVelocity[c];
+				stageSums[6 + c][body] += weights[stage] * rigidBodies.force(c)[body];
+				stageSums[9 + c][body] += weights[stage] * rigidBodies.torque(c)[body];
+			}
+		}
+	}
+
+	// New state from the weighted derivatives
+	for (unsigned int body = 0; body < spawnedObjects; body++) {
+		for (int c = 0; c < 3; c++) {
+			bodyVelocities[c][body] = stageSums[c][body];
+			bodyAngularVelocities[c][body] = stageSums[3 + c][body];
+		}
+
+		if (sleepingBodies[body] != BODY_AWAKE) continue;
+		for (int c = 0; c < 3; c++) {
+			rigidBodies.linearMomentum(c)[body] = startMomenta[c][body] + stageSums[6 + c][body] * deltaT;
+			rigidBodies.angularMomentum(c)[body] = startMomenta[3 + c][body] + stageSums[9 + c][body] * deltaT;
+		}
+	}
+
+	IntegratorStreams streams = integratorStreams(true);
+	for (int c = 0; c < 3; c++) streams.outPosition[c] = rigidBodies.nextPosition(c).data;
+	for (int c = 0; c < 4; c++) streams.outQuaternion[c] = rigidBodies.nextQuaternion(c).data;
+	advanceBodies(streams, 0, int(spawnedObjects), deltaT);
+
+	// The stages overwrote the state the step started from
+	for (unsigned int body = 0; body < spawnedObjects; body++) {
+		for (int c = 0; c < 3; c++) rigidBodies.position(c)[body] = startPositions[c][body];
+		for (int c = 0; c < 4; c++) rigidBodies.quaternion(c)[body] = startQuaternions[c][body];
+	}
+}
+
+/**
+* @brief Returns the streams of a batched position and quaternion update with the velocities of the integrator. The Runge-Kutta
+* stages start from the saved state and write the front buffer, all other updates go from the front to the back buffer
+*/
+IntegratorStreams CpuSolver::integratorStreams(bool fromStart)
+{
+	IntegratorStreams streams;
+
+	for (int c = 0; c < 3; c++) {
+		streams.position[c] = fromStart ? startPositions[c].data() : rigidBodies.position(c).data;
+		streams.velocity[c] = bodyVelocities[c].data();
+		streams.angularVelocity[c] = bodyAngularVelocities[c].data();
+		streams.outPosition[c] = fromStart ? rigidBodies.position(c).data : rigidBodies.nextPosition(c).data;
+	}
+	for (int c = 0; c < 4; c++) {
+		streams.quaternion[c] = fromStart ? startQuaternions[c].data() : rigidBodies.quaternion(c).data;
+		streams.outQuaternion[c] = fromStart ? rigidBodies.quaternion(c).data : rigidBodies.nextQuaternion(c).data;
+	}
+	streams.skip = sleepingBodies.data();
+
+	return streams;
+}
+
+/**
+* @brief Time step controller: reduces the speed of the fastest particle and the deepest overlap of the step and picks the
+* next time step. A particle may travel maxTravel particle diameters per step, once particles overlap by more than
+* maxPenetration diameters the distance shrinks proportionally. The change per step is limited by timeStepGrowth and
+* timeStepShrink, the result by minTimeStep and timeStep
+*/
+bool CpuSolver::timeStepPass(float deltaT)
+{
+	// Particle speed - the velocity of the body plus the spin at the outermost particle
+	maxParticleSpeed = 0.f;
+
+	std::vector<unsigned int> const & types = bodyTypes.getBodyTypes();
+
+	for (unsigned int body = 0; body < spawnedObjects; body++) {
+
+		if (sleepingBodies[body] != BODY_AWAKE) continue;
+
+		float linearMomentum[3], angularMomentum[3], angularVelocity[3];
+		for (int c = 0; c < 3; c++) {
+			linearMomentum[c] = rigidBodies.linearMomentum(c)[body];
+			angularMomentum[c] = rigidBodies.angularMomentum(c)[body];
+		}
+		multiplyVector(bodyTransforms[body].inverseInertia, angularMomentum, angularVelocity);
+
+		float speed = std::sqrt(linearMomentum[0] * linearMomentum[0] + linearMomentum[1] * linearMomentum[1] + linearMomentum[2] * linearMomentum[2]) / bodyMass(body);
+		float angularSpeed = std::sqrt(angularVelocity[0] * angularVelocity[0] + angularVelocity[1] * angularVelocity[1] + angularVelocity[2] * angularVelocity[2]);
+
+		maxParticleSpeed = std::max(maxParticleSpeed, speed + angularSpeed * bodyTypes.getType(types[body]).radius);
+	}
+
+	maxOverlap = 0.f;
+	for (size_t thread = 0; thread < threadOverlaps.size(); thread++) maxOverlap = std::max(maxOverlap, threadOverlaps[thread]);
+
+	float travelLimit = parameters.maxTravel * parameters.particleDiameter;
+	float overlapLimit = parameters.maxPenetration * parameters.particleDiameter;
+
+	// Deep overlaps shorten the distance a particle may travel - resting contacts keep large steps, fast impacts subdivide
+	if (maxOverlap > overlapLimit) travelLimit *= overlapLimit / maxOverlap;
+
+	float candidate = parameters.timeStep;
+	if (maxParticleSpeed > 0.f) candidate = std::min(candidate, travelLimit / maxParticleSpeed);
+
+	candidate = std::min(std::max(candidate, deltaT * parameters.timeStepShrink), deltaT * parameters.timeStepGrowth);
+	nextTimeStep = std::min(std::max(candidate, parameters.minTimeStep), parameters.timeStep);
+
+	return true;
+}
+
+/**
+* @brief Puts the islands whose bodies all rested for sleepSteps steps to sleep and wakes the sleeping bodies of the other
+* islands. The islands are built from the pairs of the broad phase, so a body whose box reaches a sleeping body wakes its
+* whole island. Sleeping bodies keep zero momenta
+*/
+bool CpuSolver::islandPass(void)
+{
+	islands.build(int(spawnedObjects), broadPhase.getPairs());
+
+	std::vector<unsigned int> const & bodyIslands = islands.getBodyIslands();
+	std::vector<unsigned char> restingIslands(islands.getNumIslands(), 1);
+
+	float linearThreshold = parameters.sleepLinearMomentum * parameters.sleepLinearMomentum;
+	float angularThreshold = parameters.sleepAngularMomentum * parameters.sleepAngularMomentum;
+	unsigned int sleepSteps = unsigned(std::max(parameters.sleepSteps, 1));
+
+	for (unsigned int body = 0; body < spawnedObjects; body++) {
+
+		if (sleepingBodies[body] == BODY_DESPAWNED) continue;
+
+		if (sleepingBodies[body] == BODY_AWAKE) {
+
+			float linear = 0.f, angular = 0.f;
+			for (int c = 0; c < 3; c++) {
+				linear += rigidBodies.linearMomentum(c)[body] * rigidBodies.linearMomentum(c)[body];
+				angular += rigidBodies.angularMomentum(c)[body] * rigidBodies.angularMomentum(c)[body];
+			}
+
+			bool resting = linear < linearThreshold && angular < angularThreshold;
+			restingSteps[body] = resting ? std::min(restingSteps[body] + 1, sleepSteps) : 0u;
+		}
+
+		if (restingSteps[body] < sleepSteps) restingIslands[bodyIslands[body]] = 0;
+	}
+
+	for (unsigned int body = 0; body < spawnedObjects; body++) {
+
+		if (sleepingBodies[body] == BODY_DESPAWNED) continue;
+
+		if (restingIslands[bodyIslands[body]]) {
+
+			if (sleepingBodies[body] == BODY_AWAKE) {
+				sleepingBodies[body] = BODY_FALLING_ASLEEP;
+
+				for (int c = 0; c < 3; c++) {
+					rigidBodies.linearMomentum(c)[body] = 0.f;
+					rigidBodies.angularMomentum(c)[body] = 0.f;
+				}
+			}
+			else {
+				sleepingBodies[body] = BODY_ASLEEP;
+			}
+		}
+		else if (sleepingBodies[body] != BODY_AWAKE) {
+			// Woken bodies start counting again
+			sleepingBodies[body] = BODY_AWAKE;
+			restingSteps[body] = 0u;
+		}
+	}
+
+	return true;
+}
+
+// --------------------------------------------------
+//  FUSED STAGES
+// --------------------------------------------------
+
+/**
+* @brief Fused particleValuePass() and grid histogram: calculates the particle positions and velocities body by body and
+* counts each particle into the grid right after calculating it, so the histogram does not read the positions back. The
+* positions and velocities are still written, the contact stage reads the neighbours from them. The relative positions are
+* only written if the particle state is materialized
+*/
+bool CpuSolver::fusedParticleGridStage(void)
+{
+	float * positionX = particles.position(ComponentX).data;
+	float * positionY = particles.position(ComponentY).data;
+	float * positionZ = particles.position(ComponentZ).data;
+	float * velocityX = particles.velocity(ComponentX).data;
+	float * velocityY = particles.velocity(ComponentY).data;
+	float * velocityZ = particles.velocity(ComponentZ).data;
+	float * relativeX = particles.relativePosition(ComponentX).data;
+	float * relativeY = particles.relativePosition(ComponentY).data;
+	float * relativeZ = particles.relativePosition(ComponentZ).data;
+	unsigned int * bodies = particles.body().data;
+
+	std::vector<unsigned int> const & types = bodyTypes.getBodyTypes();
+	std::vector<unsigned int> const & bodyOffsets = bodyTypes.getBodyParticleOffsets();
+
+	int numCells = prepareCells();
+
+	threadPool.parallelFor(0, int(spawnedObjects), tasksPerBlock(int(spawnedObjects)), [&](int begin, int end, int) {
+		for (int body = begin; body < end; body++) {
+
+			BodyType const & type = bodyTypes.getType(types[body]);
+			int first = int(bodyOffsets[body]);
+
+			// Particles of despawned bodies stay out of the grid
+			if (sleepingBodies[body] == BODY_DESPAWNED) {
+				for (int particle = 0; particle < type.numParticles; particle++) particleCells[particleSlots[first + particle]] = -1;
+				continue;
+			}
+
+			// The particles of sleeping bodies did not move, they only go into the grid
+			if (sleepingBodies[body] == BODY_ASLEEP) {
+				for (int particle = 0; particle < type.numParticles; particle++) {
+					unsigned int slot = particleSlots[first + particle];
+					countParticle(slot, positionX[slot], positionY[slot], positionZ[slot], numCells);
+				}
+				continue;
+			}
+
+			BodyTransform const & transform = bodyTransforms[body];
+			float const * rotation = transform.rotation;
+			float const * velocity = transform.velocity;
+			float const * angularVelocity = transform.angularVelocity;
+
+			float bodyPosition[3];
+			for (int c = 0; c < 3; c++) bodyPosition[c] = rigidBodies.position(c)[body];
+
+			float const * templateX = bodyTypes.getTemplate(ComponentX) + type.firstParticle;
+			float const * templateY = bodyTypes.getTemplate(ComponentY) + type.firstParticle;
+			float const * templateZ = bodyTypes.getTemplate(ComponentZ) + type.firstParticle;
+
+			for (int particle = 0; particle < type.numParticles; particle++) {
+
+				unsigned int slot = particleSlots[first + particle];
+
+				float rx = rotation[0] * templateX[particle] + rotation[3] * templateY[particle] + rotation[6] * templateZ[particle];
+				float ry = rotation[1] * templateX[particle] + rotation[4] * templateY[particle] + rotation[7] * templateZ[particle];
+				float rz = rotation[2] * templateX[particle] + rotation[5] * templateY[particle] + rotation[8] * templateZ[particle];
+
+				if (parameters.materializeParticleState) {
+					relativeX[slot] = rx;
+					relativeY[slot] = ry;
+					relativeZ[slot] = rz;
+				}
+				bodies[slot] = body;
+
+				float px = bodyPosition[0] + rx;
+				float py = bodyPosition[1] + ry;
+				float pz = bodyPosition[2] + rz;
+
+				// The neighbours of the contact stage are read from the streams
+				positionX[slot] = px;
+				positionY[slot] = py;
+				positionZ[slot] = pz;
+
+				velocityX[slot] = velocity[0] + (angularVelocity[1] * rz - angularVelocity[2] * ry);
+				velocityY[slot] = velocity[1] + (angularVelocity[2] * rx - angularVelocity[0] * rz);
+				velocityZ[slot] = velocity[2] + (angularVelocity[0] * ry - angularVelocity[1] * rx);
+
+				countParticle(slot, px, py, pz, numCells);
+			}
+		}
+	});
+
+	buildCells(numCells);
+
+	return true;
+}
+
+/**
+* @brief Fused collisionPass() and momentaPass(): calculates the force of each particle and adds it to the force and torque of its body
+* right away. The relative position is recalculated from the rotation of the body, forces and relative positions are only
+* written if the particle state is materialized. Large bodies are split into blocks like in momentaPass()
+*/
+bool CpuSolver::fusedContactMomentaStage(void)
+{
+	ContactParticles contactParticles;
+	ContactParameters contactParameters;
+	contactSetup(contactParticles, contactParameters);
+
+	float * forceX = particles.force(ComponentX).data;
+	float * forceY = particles.force(ComponentY).data;
+	float * forceZ = particles.force(ComponentZ).data;
+	float * relativeX = particles.relativePosition(ComponentX).data;
+	float * relativeY = particles.relativePosition(ComponentY).data;
+	float * relativeZ = particles.relativePosition(ComponentZ).data;
+
+	std::vector<unsigned int> const & types = bodyTypes.getBodyTypes();
+	std::vector<unsigned int> const & bodyOffsets = bodyTypes.getBodyParticleOffsets();
+
+	int numBlocks = int(blockOffsets[spawnedObjects]);
+	partialMomenta.resize(size_t(numBlocks) * 6);
+
+	threadPool.parallelFor(0, numBlocks, tasksPerBlock(numBlocks), [&](int begin, int end, int thread) {
+
+		std::vector<unsigned int> candidates;
+		float overlap = 0.f;
+
+		for (int block = begin; block < end; block++) {
+
+			unsigned int body = blockBodies[block];
+			if (sleepingBodies[body] != BODY_AWAKE) continue;
+
+			BodyType const & type = bodyTypes.getType(types[body]);
+			float const * templateX = bodyTypes.getTemplate(ComponentX) + type.firstParticle;
+			float const * templateY = bodyTypes.getTemplate(ComponentY) + type.firstParticle;
+			float const * templateZ = bodyTypes.getTemplate(ComponentZ) + type.firstParticle;
+
+			bool singleBlock = blockOffsets[body + 1] - blockOffsets[body] == 1u;
+			int firstParticle = singleBlock ? 0 : int(block - blockOffsets[body]) * PARTICLE_BLOCK_SIZE;
+			int lastParticle = singleBlock ? type.numParticles : std::min(firstParticle + PARTICLE_BLOCK_SIZE, type.numParticles);
+
+			float const * rotation = bodyTransforms[body].rotation;
+
+			float linearMomentum[3] = { 0.f, 0.f, 0.f };
+			float angularMomentum[3] = { 0.f, 0.f, 0.f };
+
+			for (int particle = firstParticle; particle < lastParticle; particle++) {
+
+				unsigned int slot = particleSlots[bodyOffsets[body] + particle];
+
+				float force[3];
+				contactForce(slot, contactParticles, contactParameters, candidates, force, &overlap);
+
+				float rx = rotation[0] * templateX[particle] + rotation[3] * templateY[particle] + rotation[6] * templateZ[particle];
+				float ry = rotation[1] * templateX[particle] + rotation[4] * templateY[particle] + rotation[7] * templateZ[particle];
+				float rz = rotation[2] * templateX[particle] + rotation[5] * templateY[particle] + rotation[8] * templateZ[particle];
+
+				if (parameters.materializeParticleState) {
+					forceX[slot] = force[0];
+					forceY[slot] = force[1];
+					forceZ[slot] = force[2];
+					relativeX[slot] = rx;
+					relativeY[slot] = ry;
+					relativeZ[slot] = rz;
+				}
+
+				linearMomentum[0] += force[0];
+				linearMomentum[1] += force[1];
+				linearMomentum[2] += force[2];
+
+				angularMomentum[0] += ry * force[2] - rz * force[1];
+				angularMomentum[1] += rz * force[0] - rx * force[2];
+				angularMomentum[2] += rx * force[1] - ry * force[0];
+			}
+
+			if (singleBlock) {
+				for (int c = 0; c < 3; c++) {
+					rigidBodies.force(c)[body] = linearMomentum[c];
+					rigidBodies.torque(c)[body] = angularMomentum[c];
+				}
+			}
+			else {
+				for (int c = 0; c < 3; c++) {
+					partialMomenta[size_t(block) * 6 + c] = linearMomentum[c];
+					partialMomenta[size_t(block) * 6 + 3 + c] = angularMomentum[c];
+				}
+			}
+		}
+
+		threadOverlaps[thread] = std::max(threadOverlaps[thread], overlap);
+	});
+
+	if (largeBodies) combineMomenta();
+
+	return true;
+}
+
+// --------------------------------------------------
+//  Helpers
+// --------------------------------------------------
+
+/** @brief Calculates the integer coordinates of the voxel containing the given position
+*/
+void CpuSolver::voxelCoordinates(float x, float y, float z, int * voxel) const
+{
+	voxel[0] = int(std::floor((x - btmLeftFrontCorner[0]) / voxelLength));
+	voxel[1] = int(std::floor((y - btmLeftFrontCorner[1]) / voxelLength));
+	voxel[2] = int(std::floor((z - btmLeftFrontCorner[2]) / voxelLength));
+}
+
+/**
+* @brief Returns the linear index of the voxel containing the given position or -1 if it lies outside of the grid
+*/
+int CpuSolver::voxelIndex(float x, float y, float z) const
+{
+	int voxel[3];
+	voxelCoordinates(x, y, z, voxel);
+
+	if (voxel[0] < 0 || voxel[1] < 0 || voxel[2] < 0) return -1;
+	if (voxel[0] >= gridResolution[0] || voxel[1] >= gridResolution[1] || voxel[2] >= gridResolution[2]) return -1;
+
+	return (voxel[2] * gridResolution[1] + voxel[1]) * gridResolution[0] + voxel[0];
+}
+
+/**
+* @brief Returns the bucket of the hashed grid the voxel falls into. numCells has to be a power of two
+*/
+int CpuSolver::hashedCell(int x, int y, int z, int numCells) const
+{
+	// Hash function of Teschner et al., "Optimized Spatial Hashing for Collision Detection of Deformable Objects"
+	unsigned int hash = (unsigned int)(x) * 73856093u ^ (unsigned int)(y) * 19349663u ^ (unsigned int)(z) * 83492791u;
+	return int(hash & unsigned(numCells - 1));
+}
+
+/**
+* @brief Returns the number of tasks per block of a parallel loop over numTasks tasks - bodies or particle blocks - so a block
+* holds about PARTICLE_BLOCK_SIZE particles
+*/
+int CpuSolver::tasksPerBlock(int numTasks) const
+{
+	return std::max(int((long long)(PARTICLE_BLOCK_SIZE) * numTasks / std::max(getNumParticles(), 1)), 1);
+}
+
+/** @brief Returns the mass of the given body - the one of its type or the mass of the parameters
+*/
+float CpuSolver::bodyMass(unsigned int body) const
+{
+	float mass = bodyTypes.getType(bodyTypes.getBodyTypes()[body]).mass;
+	return mass > 0.f ? mass : parameters.mass;
+}
+
+/** @brief Allocates the cell ranges and the zeroed histogram of the grid pass
+*/
+void CpuSolver::resizeCells(int numCells)
+{
+	cellStart.assign(numCells + 1, 0u);
+	cellBodies.assign(numCells, CELL_MIXED_BODIES);
+	cellCounts.reset(new std::atomic<unsigned int>[numCells]());
+}
+
+/**
+* @brief Tells whether a sphere around the position is clear of the particles in the collision grid of the last step. A particle
+* counts as a sphere of one particle diameter. Without a grid - before the first step or after the grid changed - it is clear
+* @param extent		Radius of the sphere, e.g. the radius of a body type plus half a particle diameter
+* @param travel		Distance each body moved since the grid pass, the particles keep it as well
+* @param maxTravel	Largest distance of travel, also taken for the particles of bodies which moved to another index since
+*/
+bool CpuSolver::spawnPositionFree(float const * position, float extent, std::vector<float> const & travel, float maxTravel) const
+{
+	bool hashed = parameters.gridType == CollisionGridHashed;
+	int numCells = int(cellStart.size()) - 1;
+
+	if (numCells <= 0) return true;
+	if (!hashed && numCells != gridResolution[0] * gridResolution[1] * gridResolution[2]) return true;
+	if (hashed && ((numCells & (numCells - 1)) != 0 || particleVoxels.size() < cellParticles.size())) return true;
+
+	float reach = extent + parameters.particleDiameter / 2.f;
+	float maxReach = reach + maxTravel;
+
+	int lower[3], upper[3];
+	voxelCoordinates(position[0] - maxReach, position[1] - maxReach, position[2] - maxReach, lower);
+	voxelCoordinates(position[0] + maxReach, position[1] + maxReach, position[2] + maxReach, upper);
+
+	// The dense grid has no particles outside of its bounds
+	if (!hashed) {
+		for (int c = 0; c < 3; c++) {
+			lower[c] = std::max(lower[c], 0);
+			upper[c] = std::min(upper[c], gridResolution[c] - 1);
+		}
+	}
+
+	float const * positionX = particles.position(ComponentX).data;
+	float const * positionY = particles.position(ComponentY).data;
+	float const * positionZ = particles.position(ComponentZ).data;
+	unsigned int const * bodies = particles.body().data;
+
+	for (int z = lower[2]; z <= upper[2]; z++) {
+		for (int y = lower[1]; y <= upper[1]; y++) {
+			for (int x = lower[0]; x <= upper[0]; x++) {
+
+				int cell = hashed ? hashedCell(x, y, z, numCells) : (z * gridResolution[1] + y) * gridResolution[0] + x;
+				unsigned long long key = voxelKey(x, y, z);
+
+				for (unsigned int idx = cellStart[cell]; idx < cellStart[cell + 1]; idx++) {
+
+					unsigned int slot = cellParticles[idx];
+					if (hashed && particleVoxels[slot] != key) continue;
+
+					float dx = positionX[slot] - position[0];
+					float dy = positionY[slot] - position[1];
+					float dz = positionZ[slot] - position[2];
+					float particleReach = reach + (bodies[slot] < travel.size() ? travel[bodies[slot]] : maxTravel);
+					if (dx * dx + dy * dy + dz * dz < particleReach * particleReach) return false;
+				}
+			}
+		}
+	}
+
+	return true;
+}
+
+/** @brief Returns the slot of each particle id in the streams of the particle state
+*/
+std::vector<unsigned int> const & CpuSolver::getParticleSlots(void) const
+{
+	return particleSlots;
+}
+
+/** @brief Returns the rotation, inverse inertia tensor and velocities of the bodies of the last step - e.g. for rendering
+*/
+AlignedArray<BodyTransform> const & CpuSolver::getBodyTransforms(void) const
+{
+	return bodyTransforms;
+}
+
+/** @brief Returns the body types and the particle ranges of the bodies
+*/
+CpuBodyTypes const & CpuSolver::getBodyTypes(void) const
+{
+	return bodyTypes;
+}
+
+/** @brief Returns the emitters and the spawns they owe
+*/
+CpuEmitters const & CpuSolver::getEmitters(void) const
+{
+	return emitters;
+}
+
+/** @brief Returns the body pairs found by the broad phase of the last step
+*/
+CpuBroadPhase const & CpuSolver::getBroadPhase(void) const
+{
+	return broadPhase;
+}
+
+/** @brief Returns the islands of the last step. Only built while sleeping is enabled
+*/
+CpuIslands const & CpuSolver::getIslands(void) const
+{
+	return islands;
+}
+
+/** @brief Returns the sleep state of every body, 0 for the bodies which are awake and 3 for despawned bodies
+*/
+std::vector<unsigned char> const & CpuSolver::getSleepingBodies(void) const
+{
+	return sleepingBodies;
+}
+
+/** @brief Returns the number of particles of the currently simulated rigid bodies
+*/
+int CpuSolver::getNumParticles(void) const
+{
+	std::vector<unsigned int> const & bodyOffsets = bodyTypes.getBodyParticleOffsets();
+	return bodyOffsets.size() > spawnedObjects ? int(bodyOffsets[spawnedObjects]) : 0;
+}
+
+/** @brief Returns the number of rigid bodies in use - the live ones and the despawned ones which were not compacted yet
+*/
+unsigned int CpuSolver::getSpawnedObjects(void) const
+{
+	return spawnedObjects;
+}
+
+/** @brief Returns the number of live rigid bodies
+*/
+unsigned int CpuSolver::getLiveObjects(void) const
+{
+	return spawnedObjects - numFreeBodies;
+}
+
+/**
+* @brief Returns a number which changes whenever a body index goes to another body: on a reset, when a spawn recycles the slot of a
+* despawned body and when compactBodies() moves bodies. Indices of two states with the same layout belong to the same bodies
+*/
+unsigned int CpuSolver::getBodyLayout(void) const
+{
+	return bodyLayout;
+}
+
+/** @brief Returns the rigid body state. Positions and quaternions of the front buffer hold the result of the last step
+*/
+RigidBodyState const & CpuSolver::getRigidBodyState(void) const
+{
+	return rigidBodies;
+}
+
+/** @brief Returns the particle state of the last step
+*/
+ParticleState const & CpuSolver::getParticleState(void) const
+{
+	return particles;
+}
@@ -0,0 +1,279 @@
+#pragma once
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+#include "CpuSolverState.h"
+#include "CpuBodyTypes.h"
+#include "CpuBroadPhase.h"
+#include "CpuCheckpoint.h"
+#include "CpuContactKernel.h"
+#include "CpuEmitters.h"
+#include "CpuIntegrator.h"
+#include "CpuIslands.h"
+#include "CpuThreadPool.h"
+#include "CpuTrajectory.h"
+
+// Particles per block of the parallel passes - the unit of work the threads steal from each other
+const int PARTICLE_BLOCK_SIZE = 256;
+
+// Bodies with at least this many particles are reduced in blocks of particles by several threads
+const int LARGE_BODY_PARTICLES = 4 * PARTICLE_BLOCK_SIZE;
+
+// Storage of the collision grid
+enum CollisionGridType {
+	CollisionGridDense = 0,	// One cell per voxel of the grid bounds - particles outside of the bounds do not collide
+	CollisionGridHashed = 1	// Spatial hash of the occupied voxels - memory grows with the particles, the domain is unbounded
+};
+
+// Simulation parameters - the counterpart of the API vars of the RigidSolver plugin
+struct CpuSolverParameters {
+	float gravity = 9.807f;
+	float mass = 1.f; // Mass of the bodies whose type has no mass of its own
+	float springCoefficient = .5f;
+	float dampingCoefficient = .5f;
+	float particleDiameter = .01f;
+	float spawnTime = 1.f; // Seconds of simulated time between two spawns at the emitter position, unused once emitters are added
+	int spawnAttempts = 8; // Candidate positions an emitter draws for a spawn before the spawn waits for the next step
+	float timeStep = 1.f / 120.f; // Fixed time step of advance() in seconds
+	int maxSubsteps = 8; // Most steps advance() runs per call, the remaining time is dropped
+	bool adaptiveTimeStep = false; // Picks the time step of the next step from the particle speeds and overlaps, timeStep is the ceiling
+	float minTimeStep = 1.f / 4000.f; // Floor of the adaptive time step
+	float maxTravel = .1f; // Particle diameters a particle may travel per step
+	float maxPenetration = .25f; // Particle diameters two particles may overlap before the step shrinks
+	float timeStepGrowth = 1.25f; // Largest factor between two adaptive time steps
+	float timeStepShrink = .5f; // Smallest factor between two adaptive time steps
+	int numRigidBodies = 100; // Live bodies besides the first one - the storage grows with the spawned bodies
+	CollisionGridType gridType = CollisionGridDense;
+	bool bodySelfContacts = false; // Contacts between the particles of one body - collision.frag computes them
+	bool broadPhase = true; // Skips the contact kernel for bodies whose bounding box does not overlap another one
+	bool fusedParticleStage = false; // Fuses particle values and grid histogram as well as collision and momenta passes
+	bool materializeParticleState = false; // Fused stages also write relative positions and forces, e.g. for debugging
+	bool sleeping = false; // Islands of bodies at rest are frozen until another body touches them
+	float sleepLinearMomentum = .01f; // A body rests while its momenta stay below these thresholds
+	float sleepAngularMomentum = .001f;
+	int sleepSteps = 60; // Steps all bodies of an island have to rest before it falls asleep
+	bool despawnOutsideGrid = false; // Bodies which left the grid bounds with all of their particles are despawned
+	float bodyLifetime = 0.f; // Seconds of simulated time after which a body is despawned, 0 keeps the bodies
+	int compactInterval = 60; // Steps between two compactions of the live bodies, 0 only recycles the slots of despawned bodies
+	int reorderInterval = 10; // Steps between two Morton reorders of the particles, 0 keeps the particles in id order
+	IntegratorType integrator = IntegratorExplicitEuler; // Changes of the integrator require a reset
+	bool deterministic = false; // Same trajectory on any number of threads and machine - scalar contact kernel, sorted grid cells
+};
+
+// Progress of fastForward(), handed to its callback
+struct FastForwardProgress {
+	int steps = 0; // Steps run so far
+	float simulatedTime = 0.f; // Seconds of simulated time run so far
+	float fraction = 0.f; // Share of the requested steps or seconds which is done
+	double wallTime = 0.0; // Seconds of wall clock time since the start
+	unsigned int liveObjects = 0u;
+	bool checkpointSaved = false;
+};
+
+// Called by fastForward() with its progress, returning false stops it after the current step
+typedef std::function<bool(FastForwardProgress const & progress)> FastForwardCallback;
+
+// Length of a fastForward() run and how often it reports
+struct FastForwardOptions {
+	int numSteps = 0; // Steps to run, 0 runs for simulatedTime instead
+	float simulatedTime = 0.f; // Seconds of simulated time to run if numSteps is 0 - the last step is shortened to end on it
+	int progressInterval = 60; // Steps between two calls of the callback, 0 only calls it after the last step
+	FastForwardCallback progress;
+	std::string checkpointPath; // Checkpoint written after the last step, empty writes none
+};
+
+// Headless implementation of the solver passes of the RigidSolver plugin.
+// Works on plain arrays and has no dependency on OpenGL or the OGL4Core framework.
+// The state is kept as structure of arrays (see CpuSolverState.h), quaternions store the scalar part in x.
+class CpuSolver
+{
+public:
+	CpuSolver();
+	~CpuSolver();
+
+	bool setModel(float const * particlePositions, int numParticles, float const * inertiaTensor);
+	int addBodyType(float const * particlePositions, int numParticles, float const * inertiaTensor, float mass);
+	bool setSpawnTypes(std::vector<int> const & types);
+	void setGrid(float const * btmLeftFront, float const * topRightBack, float voxelLength);
+	void setEmitterPosition(float x, float y, float z);
+	int addEmitter(Emitter const & emitter);
+	bool setEmitter(int emitter, Emitter const & settings);
+	bool burst(int emitter, int numBodies);
+	void clearEmitters(void);
+
+	CpuSolverParameters & getParameters(void);
+
+	bool setContactKernelISA(ContactKernelISA isa);
+	ContactKernelISA getContactKernelISA(void) const;
+
+	void setNumThreads(int numThreads);
+	int getNumThreads(void) const;
+
+	bool resetSimulation(void);
+	bool step(float deltaT);
+	int advance(float frameTime);
+	FastForwardProgress fastForward(FastForwardOptions const & options);
+	bool saveCheckpoint(std::string const & path) const;
+	bool loadCheckpoint(std::string const & path);
+	bool writeTrajectoryFrame(TrajectoryWriter & writer, double time) const;
+	float getTimeStep(void) const;
+	float getMaxParticleSpeed(void) const;
+	float getMaxOverlap(void) const;
+	double getCollisionPassTime(void) const;
+
+	unsigned long long computeStateChecksum(void) const;
+	unsigned long long getStateChecksum(void) const;
+
+	int getNumParticles(void) const;
+	unsigned int getSpawnedObjects(void) const;
+	unsigned int getLiveObjects(void) const;
+	unsigned int getBodyLayout(void) const;
+	RigidBodyState const & getRigidBodyState(void) const;
+	ParticleState const & getParticleState(void) const;
+	std::vector<unsigned int> const & getParticleSlots(void) const;
+	AlignedArray<BodyTransform> const & getBodyTransforms(void) const;
+	CpuBodyTypes const & getBodyTypes(void) const;
+	CpuEmitters const & getEmitters(void) const;
+	CpuBroadPhase const & getBroadPhase(void) const;
+	CpuIslands const & getIslands(void) const;
+	std::vector<unsigned char> const & getSleepingBodies(void) const;
+
+private:
+
+	void selectContactKernel(void);
+	void reserveBodies(int numBodies);
+	void layoutBodies(void);
+	void initializeBodies(int first, int last);
+	int spawnBody(unsigned int type);
+
+	bool emitterPass(float deltaT);
+	bool evaluateForces(void);
+	bool reorderParticles(void);
+	bool bodyTransformPass(void);
+	bool particleValuePass(void);
+	bool broadPhasePass(void);
+	bool collisionGridPass(void);
+	bool collisionPass(void);
+	bool momentaPass(void);
+	bool solverPass(float deltaT);
+	bool islandPass(void);
+	bool timeStepPass(float deltaT);
+	bool despawnPass(float deltaT);
+	bool compactBodies(void);
+
+	bool fusedParticleGridStage(void);
+	bool fusedContactMomentaStage(void);
+
+	void eulerIntegration(float deltaT);
+	void verletIntegration(float deltaT);
+	void rungeKuttaIntegration(float deltaT);
+	IntegratorStreams integratorStreams(bool fromStart);
+
+	int prepareCells(void);
+	void countParticle(int slot, float x, float y, float z, int numCells);
+	void buildCells(int numCells);
+	void contactSetup(ContactParticles & contactParticles, ContactParameters & contactParameters);
+	void contactForce(int slot, ContactParticles const & contactParticles, ContactParameters const & contactParameters,
+		std::vector<unsigned int> & candidates, float * force, float * overlap) const;
+	void sumMomenta(int body, int first, int last, float * momenta) const;
+	void combineMomenta(void);
+	int tasksPerBlock(int numTasks) const;
+	float bodyMass(unsigned int body) const;
+
+	void voxelCoordinates(float x, float y, float z, int * voxel) const;
+	int voxelIndex(float x, float y, float z) const;
+	int hashedCell(int x, int y, int z, int numCells) const;
+	void resizeCells(int numCells);
+	bool spawnPositionFree(float const * position, float extent, std::vector<float> const & travel, float maxTravel) const;
+
+	CpuSolverParameters parameters;
+
+	// Models - the body types and the particle ranges of the bodies
+	CpuBodyTypes bodyTypes;
+
+	// Blocks of the momenta reduction - bodies with LARGE_BODY_PARTICLES or more particles are split into blocks of
+	// PARTICLE_BLOCK_SIZE particles. The blocks of body b are blockOffsets[b] to blockOffsets[b + 1] - 1
+	std::vector<unsigned int> blockOffsets;
+	std::vector<unsigned int> blockBodies;
+	bool largeBodies = false; // At least one body has more than one block
+
+	// Grid
+	float btmLeftFrontCorner[3];
+	float topRightBackCorner[3];
+	float voxelLength = .025f;
+	int gridResolution[3];
+	float emitterPosition[3];
+
+	// Emitters - without any the bodies spawn one by one at emitterPosition like in the RigidSolver plugin
+	CpuEmitters emitters;
+
+	// Solver
+	unsigned int spawnedObjects = 1u; // Always starts with one instance
+	int capacity = 0; // Bodies the state streams are allocated for
+	bool layoutPending = false; // Spawns changed the types of bodies, layoutBodies() has to run before the next pass
+	float timeSinceSpawn = 0.f;
+	unsigned int stepCount = 0;
+	float accumulatedTime = 0.f; // Seconds passed to advance() which are not simulated yet
+	float nextTimeStep = 1.f / 120.f; // Picked by timeStepPass()
+	float maxParticleSpeed = 0.f;
+	float maxOverlap = 0.f;
+	std::vector<float> threadOverlaps; // Deepest overlap the contact passes found on each thread
+	unsigned long long stateChecksum = 0ull; // Checksum after the last step in deterministic mode
+	double collisionPassTime = 0.0; // Seconds of wall clock time spent in the contact forces since the reset
+
+	// Contact kernel - picked by runtime dispatch once and again when the instruction set or the deterministic mode change
+	ContactKernelISA contactKernelISA;
+	ContactKernelFunction contactKernel;
+	bool contactKernelDeterministic = false; // Mode contactKernel was picked for
+
+	// Pairs of bodies which may touch
+	CpuBroadPhase broadPhase;
+	std::vector<float> bodyExtents; // Half edge length of the box of each body
+
+	// Islands of the bodies which may touch and the sleep state of the bodies - see BODY_AWAKE in CpuSolver.cpp
+	CpuIslands islands;
+	std::vector<unsigned char> sleepingBodies;
+	std::vector<unsigned int> restingSteps; // Consecutive steps each body stayed below the sleep thresholds
+
+	// Body pool - slots of despawned bodies wait on the free list until a spawn recycles them or compactBodies() fills them
+	std::vector<std::vector<unsigned int> > freeBodies; // Despawned bodies of each type
+	unsigned int numFreeBodies = 0u;
+	unsigned int spawnCount = 0u; // Spawns since the reset - the position in the spawn sequence
+	std::vector<float> bodyAges; // Seconds of simulated time since each body spawned
+	unsigned int bodyLayout = 0u; // Changes whenever a body index goes to another body - resets, recycled slots and compaction
+
+	// Threads of the parallel passes
+	CpuThreadPool threadPool;
+
+	// State - the particle streams are sorted along the Z-order curve, particle id (see CpuBodyTypes::getBodyParticleOffsets())
+	// and slot in the streams are mapped by particleSlots and slotParticles. Grid and collision pass work on slots
+	RigidBodyState rigidBodies;
+	AlignedArray<BodyTransform> bodyTransforms;
+	ParticleState particles;
+	std::vector<unsigned int> particleSlots;
+	std::vector<unsigned int> slotParticles;
+	std::vector<float> partialMomenta; // Six sums per particle block of the large body reduction
+
+	// Integrator - velocities of the batched position and quaternion update, the state the Runge-Kutta stages start from and
+	// the weighted sums of the stage velocities (0 - 5), forces and torques (6 - 11)
+	AlignedArray<float> bodyVelocities[3];
+	AlignedArray<float> bodyAngularVelocities[3];
+	AlignedArray<float> startPositions[3];
+	AlignedArray<float> startQuaternions[4];
+	AlignedArray<float> startMomenta[6];
+	AlignedArray<float> stageSums[12];
+	float lastDeltaT = 0.f; // Length of the last step, the Verlet integrator scales the last displacement with it
+
+	// Collision grid - the particles of cell i are cellParticles[cellStart[i]] to cellParticles[cellStart[i + 1] - 1].
+	// A cell is a voxel of the dense grid or a bucket of the hashed grid, which keeps the voxel of each particle to
+	// tell apart the voxels sharing a bucket
+	std::vector<unsigned int> cellStart;
+	std::vector<unsigned int> cellParticles;
+	std::vector<int> particleCells;
+	std::vector<unsigned long long> particleVoxels;
+	std::vector<unsigned int> cellBodies; // Body of all particles of a cell or CELL_MIXED_BODIES
+	std::unique_ptr<std::atomic<unsigned int>[]> cellCounts;
+
+};
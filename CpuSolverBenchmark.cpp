@@ -0,0 +1,188 @@
+// CpuSolverBenchmark.cpp
+//
+// Benchmarks of the headless CPU solver. Every run settles a pile of bodies once, checkpoints it and measures the following steps
+// from that checkpoint, so all thread counts work on the same state.
+//
+// RigidSolverCPUBenchmark scaling [bodies] [steps] [threads]
+//	Collision pass and whole step on 1, 2, 4, ... threads up to threads (default: one per hardware thread)
+// RigidSolverCPUBenchmark deterministic [bodies] [steps] [threads]
+//	Fast and deterministic mode on the same thread counts. Fails if the checksums of the deterministic runs differ
+
+#include "CpuSolver.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Steps which pile up the bodies before the measurement
+const int SETTLE_STEPS = 300;
+const float BENCHMARK_TIME_STEP = 1.f / 120.f;
+
+// Timings of one run from the checkpoint
+struct BenchmarkResult {
+	double collisionTime = 0.0; // Seconds in the collision pass
+	double stepTime = 0.0; // Seconds in step()
+	unsigned long long checksum = 0ull; // State checksum after the last step, deterministic mode only
+};
+
+/**
+* @brief Sets up the scene: cubes of 3x3x3 particles which an emitter drops into a box, numBodies of them as soon as there is room
+*/
+static void setupScene(CpuSolver & solver, int numBodies)
+{
+	std::vector<float> cube;
+	for (int x = 0; x < 3; x++) {
+		for (int y = 0; y < 3; y++) {
+			for (int z = 0; z < 3; z++) {
+				cube.push_back((x - 1) * .01f);
+				cube.push_back((y - 1) * .01f);
+				cube.push_back((z - 1) * .01f);
+			}
+		}
+	}
+	float inertiaTensor[9] = { 1e-3f, 0.f, 0.f, 0.f, 1e-3f, 0.f, 0.f, 0.f, 1e-3f };
+
+	CpuSolverParameters & parameters = solver.getParameters();
+	parameters.numRigidBodies = numBodies;
+	parameters.integrator = IntegratorSemiImplicitEuler;
+
+	float btmLeftFront[3] = { -.4f, -.5f, -.4f };
+	float topRightBack[3] = { .4f, .5f, .4f };
+	solver.setGrid(btmLeftFront, topRightBack, .01f);
+	solver.setModel(cube.data(), int(cube.size() / 3), inertiaTensor);
+
+	Emitter emitter;
+	emitter.position[1] = .2f;
+	emitter.extent[0] = emitter.extent[2] = .3f;
+	emitter.extent[1] = .2f;
+	emitter.rate = 0.f;
+	solver.addEmitter(emitter);
+	solver.burst(0, numBodies);
+}
+
+/**
+* @brief Restores the checkpoint and runs numSteps steps on numThreads threads
+*/
+static bool runFromCheckpoint(CpuSolver & solver, std::string const & checkpoint, int numThreads, int numSteps, BenchmarkResult & result)
+{
+	solver.setNumThreads(numThreads);
+	result.checksum = 0ull;
+	if (!solver.loadCheckpoint(checkpoint)) return false;
+
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	for (int step = 0; step < numSteps; step++) solver.step(BENCHMARK_TIME_STEP);
+
+	result.stepTime = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	result.collisionTime = solver.getCollisionPassTime();
+	if (solver.getParameters().deterministic) result.checksum = solver.getStateChecksum();
+
+	return true;
+}
+
+/** @brief Thread counts 1, 2, 4, ... up to maxThreads, which is always part of them
+*/
+static std::vector<int> threadCounts(int maxThreads)
+{
+	std::vector<int> counts;
+	for (int numThreads = 1; numThreads < maxThreads; numThreads *= 2) counts.push_back(numThreads);
+	counts.push_back(maxThreads);
+
+	return counts;
+}
+
+/**
+* @brief Measures the collision pass and the whole step on 1, 2, 4, ... threads and prints their speedup over one thread
+*/
+static int scalingBenchmark(CpuSolver & solver, std::string const & checkpoint, int numSteps, int maxThreads)
+{
+	std::printf("%8s %16s %8s %16s %8s\n", "threads", "collision ms", "speedup", "step ms", "speedup");
+
+	BenchmarkResult single;
+	std::vector<int> counts = threadCounts(maxThreads);
+
+	for (size_t i = 0; i < counts.size(); i++) {
+		BenchmarkResult result;
+		if (!runFromCheckpoint(solver, checkpoint, counts[i], numSteps, result)) return EXIT_FAILURE;
+		if (i == 0) single = result;
+
+		std::printf("%8d %16.3f %7.2fx %16.3f %7.2fx\n", counts[i], result.collisionTime * 1000.0 / numSteps,
+			single.collisionTime / result.collisionTime, result.stepTime * 1000.0 / numSteps, single.stepTime / result.stepTime);
+	}
+
+	return EXIT_SUCCESS;
+}
+
+/**
+* @brief Runs the same steps in fast and in deterministic mode on 1, 2, 4, ... threads and prints the slowdown of the
+* deterministic mode. Fails if the deterministic runs end in different states
+*/
+static int deterministicBenchmark(CpuSolver & solver, std::string const & checkpoint, int numSteps, int maxThreads)
+{
+	std::printf("%8s %12s %18s %9s %18s\n", "threads", "fast ms", "deterministic ms", "slowdown", "checksum");
+
+	unsigned long long reference = 0ull;
+	bool identical = true;
+	std::vector<int> counts = threadCounts(maxThreads);
+
+	for (size_t i = 0; i < counts.size(); i++) {
+		BenchmarkResult fast, deterministic;
+
+		solver.getParameters().deterministic = false;
+		if (!runFromCheckpoint(solver, checkpoint, counts[i], numSteps, fast)) return EXIT_FAILURE;
+
+		solver.getParameters().deterministic = true;
+		if (!runFromCheckpoint(solver, checkpoint, counts[i], numSteps, deterministic)) return EXIT_FAILURE;
+		solver.getParameters().deterministic = false;
+
+		if (i == 0) reference = deterministic.checksum;
+		identical = identical && deterministic.checksum == reference;
+
+		std::printf("%8d %12.3f %18.3f %8.1f%% %18.16llx\n", counts[i], fast.stepTime * 1000.0 / numSteps,
+			deterministic.stepTime * 1000.0 / numSteps, (deterministic.stepTime / fast.stepTime - 1.0) * 100.0, deterministic.checksum);
+	}
+
+	std::printf(identical ? "Deterministic checksums are identical on all thread counts\n" : "Deterministic checksums differ\n");
+	return identical ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+int main(int argc, char ** argv)
+{
+	std::string mode = argc > 1 ? argv[1] : "scaling";
+	int numBodies = argc > 2 ? std::atoi(argv[2]) : 2000;
+	int numSteps = argc > 3 ? std::atoi(argv[3]) : 200;
+	int maxThreads = argc > 4 ? std::atoi(argv[4]) : int(std::thread::hardware_concurrency());
+
+	if ((mode != "scaling" && mode != "deterministic") || numBodies <= 0 || numSteps <= 0) {
+		std::fprintf(stderr, "Usage: %s scaling|deterministic [bodies] [steps] [threads]\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+	maxThreads = std::max(maxThreads, 1);
+
+	CpuSolver solver;
+	setupScene(solver, numBodies);
+
+	// The pile is settled once, every measurement starts from it
+	for (int step = 0; step < SETTLE_STEPS; step++) solver.step(BENCHMARK_TIME_STEP);
+
+	std::string checkpoint = "RigidSolverCPUBenchmark.ckpt";
+	if (!solver.saveCheckpoint(checkpoint)) {
+		std::fprintf(stderr, "Could not write %s\n", checkpoint.c_str());
+		return EXIT_FAILURE;
+	}
+
+	std::printf("%u bodies, %d particles, %d steps, %u hardware threads\n", solver.getLiveObjects(), solver.getNumParticles(), numSteps,
+		std::thread::hardware_concurrency());
+
+	// The deterministic mode always runs the scalar kernel
+	std::printf("Contact kernel: %s, integrator: %s\n", getContactKernelName(solver.getContactKernelISA()),
+		getIntegratorName(solver.getParameters().integrator));
+
+	int status = mode == "scaling" ? scalingBenchmark(solver, checkpoint, numSteps, maxThreads)
+		: deterministicBenchmark(solver, checkpoint, numSteps, maxThreads);
+
+	std::remove(checkpoint.c_str());
+	return status;
+}
@@ -0,0 +1,277 @@
+#include "CpuSolverState.h"
+#include <cstdlib>
+#include <new>
+
+#ifdef _WIN32
+#include <malloc.h>
+#endif
+
+/**
+* @brief Allocates memory aligned to STATE_ALIGNMENT. Must be released with alignedFree()
+*/
+void * alignedAllocate(size_t bytes)
+{
+	void * ptr = NULL;
+
+#ifdef _WIN32
+	ptr = _aligned_malloc(bytes, STATE_ALIGNMENT);
+#else
+	if (posix_memalign(&ptr, STATE_ALIGNMENT, bytes) != 0) ptr = NULL;
+#endif
+
+	if (ptr == NULL) throw std::bad_alloc();
+	return ptr;
+}
+
+/**
+* @brief Releases memory allocated with alignedAllocate()
+*/
+void alignedFree(void * ptr)
+{
+	if (ptr == NULL) return;
+
+#ifdef _WIN32
+	_aligned_free(ptr);
+#else
+	free(ptr);
+#endif
+}
+
+// --------------------------------------------------
+//  Rigid bodies
+// --------------------------------------------------
+
+RigidBodyState::RigidBodyState()
+{
+}
+
+RigidBodyState::~RigidBodyState()
+{
+}
+
+/**
+* @brief Resizes all streams to the given number of rigid bodies
+*/
+void RigidBodyState::resize(size_t numBodies)
+{
+	for (int buffer = 0; buffer < 2; buffer++) {
+		for (int c = 0; c < 4; c++) {
+			positions[buffer][c].resize(numBodies);
+			quaternions[buffer][c].resize(numBodies);
+		}
+	}
+
+	for (int c = 0; c < 3; c++) {
+		linearMomenta[c].resize(numBodies);
+		angularMomenta[c].resize(numBodies);
+		forces[c].resize(numBodies);
+		torques[c].resize(numBodies);
+	}
+
+	this->numBodies = numBodies;
+}
+
+/** @brief Returns the number of rigid bodies the streams hold
+*/
+size_t RigidBodyState::size(void) const
+{
+	return numBodies;
+}
+
+/** @brief Exchanges the front and back buffers of the positions and quaternions
+*/
+void RigidBodyState::swap(void)
+{
+	front = 1 - front;
+}
+
+/** @brief Returns a component stream of the positions which are read
+*/
+Span<float> RigidBodyState::position(int component)
+{
+	return positions[front][component].span();
+}
+
+/** @brief Returns a component stream of the quaternions which are read. The scalar part is stored in x
+*/
+Span<float> RigidBodyState::quaternion(int component)
+{
+	return quaternions[front][component].span();
+}
+
+/** @brief Returns a component stream of the positions which are written
+*/
+Span<float> RigidBodyState::nextPosition(int component)
+{
+	return positions[1 - front][component].span();
+}
+
+/** @brief Returns a component stream of the quaternions which are written
+*/
+Span<float> RigidBodyState::nextQuaternion(int component)
+{
+	return quaternions[1 - front][component].span();
+}
+
+/** @brief Returns a component stream of the linear momenta
+*/
+Span<float> RigidBodyState::linearMomentum(int component)
+{
+	return linearMomenta[component].span();
+}
+
+/** @brief Returns a component stream of the angular momenta
+*/
+Span<float> RigidBodyState::angularMomentum(int component)
+{
+	return angularMomenta[component].span();
+}
+
+/** @brief Returns a component stream of the summed up particle forces
+*/
+Span<float> RigidBodyState::force(int component)
+{
+	return forces[component].span();
+}
+
+/** @brief Returns a component stream of the summed up particle torques
+*/
+Span<float> RigidBodyState::torque(int component)
+{
+	return torques[component].span();
+}
+
+Span<float const> RigidBodyState::position(int component) const
+{
+	return positions[front][component].span();
+}
+
+Span<float const> RigidBodyState::quaternion(int component) const
+{
+	return quaternions[front][component].span();
+}
+
+Span<float const> RigidBodyState::nextPosition(int component) const
+{
+	return positions[1 - front][component].span();
+}
+
+Span<float const> RigidBodyState::nextQuaternion(int component) const
+{
+	return quaternions[1 - front][component].span();
+}
+
+Span<float const> RigidBodyState::linearMomentum(int component) const
+{
+	return linearMomenta[component].span();
+}
+
+Span<float const> RigidBodyState::angularMomentum(int component) const
+{
+	return angularMomenta[component].span();
+}
+
+Span<float const> RigidBodyState::force(int component) const
+{
+	return forces[component].span();
+}
+
+Span<float const> RigidBodyState::torque(int component) const
+{
+	return torques[component].span();
+}
+
+// --------------------------------------------------
+//  Particles
+// --------------------------------------------------
+
+ParticleState::ParticleState()
+{
+}
+
+ParticleState::~ParticleState()
+{
+}
+
+/**
+* @brief Resizes all streams to the given number of particles
+*/
+void ParticleState::resize(size_t numParticles)
+{
+	for (int c = 0; c < 3; c++) {
+		positions[c].resize(numParticles);
+		velocities[c].resize(numParticles);
+		relativePositions[c].resize(numParticles);
+		forces[c].resize(numParticles);
+	}
+	bodies.resize(numParticles);
+
+	this->numParticles = numParticles;
+}
+
+/** @brief Returns the number of particles the streams hold
+*/
+size_t ParticleState::size(void) const
+{
+	return numParticles;
+}
+
+/** @brief Returns a component stream of the particle world positions
+*/
+Span<float> ParticleState::position(int component)
+{
+	return positions[component].span();
+}
+
+/** @brief Returns a component stream of the particle velocities
+*/
+Span<float> ParticleState::velocity(int component)
+{
+	return velocities[component].span();
+}
+
+/** @brief Returns a component stream of the particle positions relative to the center of mass
+*/
+Span<float> ParticleState::relativePosition(int component)
+{
+	return relativePositions[component].span();
+}
+
+/** @brief Returns a component stream of the particle forces
+*/
+Span<float> ParticleState::force(int component)
+{
+	return forces[component].span();
+}
+
+/** @brief Returns the stream of the rigid body index of each particle
+*/
+Span<unsigned int> ParticleState::body(void)
+{
+	return bodies.span();
+}
+
+Span<float const> ParticleState::position(int component) const
+{
+	return positions[component].span();
+}
+
+Span<float const> ParticleState::velocity(int component) const
+{
+	return velocities[component].span();
+}
+
+Span<float const> ParticleState::relativePosition(int component) const
+{
+	return relativePositions[component].span();
+}
+
+Span<float const> ParticleState::force(int component) const
+{
+	return forces[component].span();
+}
+
+Span<unsigned int const> ParticleState::body(void) const
+{
+	return bodies.span();
+}
@@ -0,0 +1,187 @@
+#pragma once
+#include <cstddef>
+#include <cstring>
+#include <algorithm>
+
+// Alignment of every state stream - one cache line and one AVX-512 register
+const size_t STATE_ALIGNMENT = 64;
+
+void * alignedAllocate(size_t bytes);
+void alignedFree(void * ptr);
+
+// Component index of the x/y/z/w streams
+enum StateComponent {
+	ComponentX = 0,
+	ComponentY = 1,
+	ComponentZ = 2,
+	ComponentW = 3
+};
+
+// Non-owning view of a contiguous stream
+template <class T>
+struct Span {
+	T * data;
+	size_t size;
+
+	Span() : data(NULL), size(0) {}
+	Span(T * data, size_t size) : data(data), size(size) {}
+
+	T & operator[](size_t idx) const { return data[idx]; }
+	T * begin(void) const { return data; }
+	T * end(void) const { return data + size; }
+};
+
+// Owning, 64 byte aligned array. The allocation is rounded up to a multiple of the alignment and the elements behind size() are
+// zeroed. There is no padding if the elements already fill whole multiples of the alignment, so kernels must not read past the
+// last element - the vector kernels mask their loads instead
+template <class T>
+class AlignedArray
+{
+public:
+	AlignedArray() {}
+	~AlignedArray() { alignedFree(elements); }
+
+	void resize(size_t num);
+	void fill(T value) { std::fill(elements, elements + num, value); }
+	void swap(AlignedArray<T> &other);
+
+	T * data(void) { return elements; }
+	T const * data(void) const { return elements; }
+	size_t size(void) const { return num; }
+
+	T & operator[](size_t idx) { return elements[idx]; }
+	T const & operator[](size_t idx) const { return elements[idx]; }
+
+	Span<T> span(void) { return Span<T>(elements, num); }
+	Span<T const> span(void) const { return Span<T const>(elements, num); }
+
+private:
+	AlignedArray(const AlignedArray<T> &);
+	AlignedArray<T> & operator=(const AlignedArray<T> &);
+
+	T * elements = NULL;
+	size_t num = 0;
+	size_t capacity = 0;
+};
+
+/**
+* @brief Resizes the array. Existing elements are kept, new elements are zero initialized
+*/
+template <class T>
+void AlignedArray<T>::resize(size_t num)
+{
+	if (num > capacity) {
+		// Elements may be larger than the alignment - the allocation is rounded up in bytes
+		size_t bytes = (num * sizeof(T) + STATE_ALIGNMENT - 1) / STATE_ALIGNMENT * STATE_ALIGNMENT;
+		size_t newCapacity = bytes / sizeof(T);
+
+		T * newElements = static_cast<T *>(alignedAllocate(bytes));
+		std::memset(newElements, 0, bytes);
+		if (elements != NULL) std::memcpy(newElements, elements, this->num * sizeof(T));
+
+		alignedFree(elements);
+		elements = newElements;
+		capacity = newCapacity;
+	}
+	else if (num < this->num) {
+		// Keep the padding zeroed
+		std::memset(elements + num, 0, (this->num - num) * sizeof(T));
+	}
+
+	this->num = num;
+}
+
+template <class T>
+void AlignedArray<T>::swap(AlignedArray<T> &other)
+{
+	std::swap(elements, other.elements);
+	std::swap(num, other.num);
+	std::swap(capacity, other.capacity);
+}
+
+// Per body values derived from the quaternion and the momenta - computed once per step and shared by the passes.
+// Matrices are column major
+struct BodyTransform {
+	float rotation[9];
+	float inverseInertia[9]; // World space inverse inertia tensor R * I^-1 * R^T
+	float velocity[3];
+	float angularVelocity[3];
+};
+
+// Structure of arrays store of the rigid body state. Positions and quaternions are double buffered:
+// the passes read the front buffer and the solver writes the back buffer, swap() exchanges them
+class RigidBodyState
+{
+public:
+	RigidBodyState();
+	~RigidBodyState();
+
+	void resize(size_t numBodies);
+	size_t size(void) const;
+	void swap(void);
+
+	Span<float> position(int component);
+	Span<float> quaternion(int component);
+	Span<float> nextPosition(int component);
+	Span<float> nextQuaternion(int component);
+	Span<float> linearMomentum(int component);
+	Span<float> angularMomentum(int component);
+	Span<float> force(int component);
+	Span<float> torque(int component);
+
+	Span<float const> position(int component) const;
+	Span<float const> quaternion(int component) const;
+	Span<float const> nextPosition(int component) const;
+	Span<float const> nextQuaternion(int component) const;
+	Span<float const> linearMomentum(int component) const;
+	Span<float const> angularMomentum(int component) const;
+	Span<float const> force(int component) const;
+	Span<float const> torque(int component) const;
+
+private:
+
+	AlignedArray<float> positions[2][4];
+	AlignedArray<float> quaternions[2][4];
+	AlignedArray<float> linearMomenta[3];
+	AlignedArray<float> angularMomenta[3];
+	AlignedArray<float> forces[3]; // Sums of the particle forces and torques of the last force evaluation
+	AlignedArray<float> torques[3];
+
+	int front = 0;
+	size_t numBodies = 0;
+
+};
+
+// Structure of arrays store of the per particle values
+class ParticleState
+{
+public:
+	ParticleState();
+	~ParticleState();
+
+	void resize(size_t numParticles);
+	size_t size(void) const;
+
+	Span<float> position(int component);
+	Span<float> velocity(int component);
+	Span<float> relativePosition(int component);
+	Span<float> force(int component);
+	Span<unsigned int> body(void);
+
+	Span<float const> position(int component) const;
+	Span<float const> velocity(int component) const;
+	Span<float const> relativePosition(int component) const;
+	Span<float const> force(int component) const;
+	Span<unsigned int const> body(void) const;
+
+private:
+
+	AlignedArray<float> positions[3];
+	AlignedArray<float> velocities[3];
+	AlignedArray<float> relativePositions[3];
+	AlignedArray<float> forces[3];
+	AlignedArray<unsigned int> bodies;
+
+	size_t numParticles = 0;
+
+};
@@ -0,0 +1,832 @@
+// CpuSolverTest.cpp
+//
+// Tests of the headless CPU solver. Every test sets up a small scene, checks one guarantee of the solver and prints PASS or FAIL.
+//
+// RigidSolverCPUTest [test]
+//	Runs the test of the given name or all of them. The exit code is the number of failed tests
+
+#include "CpuSolver.h"
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+const float TEST_TIME_STEP = 1.f / 120.f;
+
+/**
+* @brief Sets up cubes of 3x3x3 particles which an emitter drops into a box, numBodies of them as soon as there is room
+*/
+static void setupScene(CpuSolver & solver, int numBodies)
+{
+	std::vector<float> cube;
+	for (int x = 0; x < 3; x++) {
+		for (int y = 0; y < 3; y++) {
+			for (int z = 0; z < 3; z++) {
+				cube.push_back((x - 1) * .01f);
+				cube.push_back((y - 1) * .01f);
+				cube.push_back((z - 1) * .01f);
+			}
+		}
+	}
+	float inertiaTensor[9] = { 1e-3f, 0.f, 0.f, 0.f, 1e-3f, 0.f, 0.f, 0.f, 1e-3f };
+
+	CpuSolverParameters & parameters = solver.getParameters();
+	parameters.numRigidBodies = numBodies;
+	parameters.integrator = IntegratorSemiImplicitEuler;
+
+	float btmLeftFront[3] = { -.3f, -.5f, -.3f };
+	float topRightBack[3] = { .3f, .5f, .3f };
+	solver.setGrid(btmLeftFront, topRightBack, .01f);
+	solver.setModel(cube.data(), int(cube.size() / 3), inertiaTensor);
+
+	Emitter emitter;
+	emitter.position[1] = .2f;
+	emitter.extent[0] = emitter.extent[2] = .2f;
+	emitter.extent[1] = .1f;
+	emitter.rate = 0.f;
+	emitter.velocity[0] = .5f;
+	emitter.coneAngle = 1.f;
+	solver.addEmitter(emitter);
+	solver.burst(0, numBodies);
+}
+
+/** @brief Returns a pseudo random number in [0, 1) - the tests draw the same numbers on every machine
+*/
+static float random01(unsigned int & state)
+{
+	state = state * 1664525u + 1013904223u;
+	return float(state >> 8) / 16777216.f;
+}
+
+/**
+* @brief The AVX2 and AVX-512 contact kernels the machine supports give the forces of the scalar kernel. A single candidate ends up
+* in one lane, so its force and overlap are bit identical. Over many candidates the lanes add up the forces in another order, so
+* the sums may differ by the rounding of the additions - at most 1e-5 of the sum of the absolute forces of the candidates
+*/
+static bool testContactKernelISAs(void)
+{
+	const int numParticles = 300;
+	const float diameter = .01f;
+
+	// Particle 0 in the middle of a cloud reaching from touching to out of reach, some particles share its body
+	std::vector<float> streams[6];
+	std::vector<unsigned int> bodies(numParticles);
+	unsigned int random = 1u;
+
+	for (int particle = 0; particle < numParticles; particle++) {
+		for (int c = 0; c < 3; c++) streams[c].push_back(particle == 0 ? 0.f : (random01(random) - .5f) * 2.5f * diameter);
+		for (int c = 0; c < 3; c++) streams[3 + c].push_back(random01(random) - .5f);
+		bodies[particle] = random01(random) < .2f ? 0u : unsigned(particle);
+	}
+
+	ContactParticles contactParticles;
+	contactParticles.positionX = streams[0].data();
+	contactParticles.positionY = streams[1].data();
+	contactParticles.positionZ = streams[2].data();
+	contactParticles.velocityX = streams[3].data();
+	contactParticles.velocityY = streams[4].data();
+	contactParticles.velocityZ = streams[5].data();
+
+	ContactParameters contactParameters;
+	contactParameters.springCoefficient = .5f;
+	contactParameters.dampingCoefficient = .5f;
+	contactParameters.particleDiameter = diameter;
+
+	// All particles, the particle itself and empty slots - lengths which leave partial vectors at the end
+	std::vector<unsigned int> candidates;
+	for (int particle = 0; particle < numParticles; particle++) {
+		candidates.push_back(unsigned(particle));
+		if (particle % 7 == 0) candidates.push_back(CONTACT_EMPTY_SLOT);
+	}
+
+	ContactKernelFunction scalar = getContactKernel(ContactKernelScalar);
+	ContactKernelISA isas[2] = { ContactKernelAVX2, ContactKernelAVX512 };
+
+	for (int i = 0; i < 2; i++) {
+		if (!isContactKernelSupported(isas[i])) {
+			std::printf("%s is not supported, skipped\n", getContactKernelName(isas[i]));
+			continue;
+		}
+		ContactKernelFunction vector = getContactKernel(isas[i]);
+
+		for (int filter = 0; filter < 2; filter++) {
+			contactParticles.body = filter ? bodies.data() : NULL;
+
+			// One candidate at a time - a contracted multiply-add in the vector kernel changes the last bits
+			float bound[3] = { 0.f, 0.f, 0.f };
+			for (size_t candidate = 0; candidate < candidates.size(); candidate++) {
+				float expected[3] = { 0.f, 0.f, 0.f }, actual[3] = { 0.f, 0.f, 0.f };
+				float expectedOverlap = 0.f, actualOverlap = 0.f;
+				scalar(contactParticles, 0u, &candidates[candidate], 1, contactParameters, expected, &expectedOverlap);
+				vector(contactParticles, 0u, &candidates[candidate], 1, contactParameters, actual, &actualOverlap);
+
+				if (actualOverlap != expectedOverlap) return false;
+				for (int c = 0; c < 3; c++) {
+					if (actual[c] != expected[c]) return false;
+					bound[c] += std::abs(expected[c]);
+				}
+			}
+
+			// All candidates at once, from every length up to all of them
+			for (size_t numCandidates = 1; numCandidates <= candidates.size(); numCandidates++) {
+				float expected[3] = { 0.f, 0.f, 0.f }, actual[3] = { 0.f, 0.f, 0.f };
+				float expectedOverlap = 0.f, actualOverlap = 0.f;
+				scalar(contactParticles, 0u, candidates.data(), int(numCandidates), contactParameters, expected, &expectedOverlap);
+				vector(contactParticles, 0u, candidates.data(), int(numCandidates), contactParameters, actual, &actualOverlap);
+
+				if (actualOverlap != expectedOverlap) return false;
+				for (int c = 0; c < 3; c++) {
+					if (std::abs(actual[c] - expected[c]) > 1e-5f * bound[c]) return false;
+				}
+			}
+		}
+	}
+
+	return true;
+}
+
+/**
+* @brief The hashed grid finds the candidates of the dense grid. The dense grid reaches far enough for all bodies, the bounds of the
+* hashed grid share its corner but the bodies collide outside of them. The buckets hold about two particles, so many of them mix
+* voxels. With the particles in id order and the scalar kernel both grids gather the same candidates in the same order, so the
+* runs are bit identical
+*/
+static bool testHashedGrid(void)
+{
+	CpuSolver dense, hashed;
+	CpuSolver * solvers[2] = { &dense, &hashed };
+
+	for (int i = 0; i < 2; i++) {
+		setupScene(*solvers[i], 150);
+
+		CpuSolverParameters & parameters = solvers[i]->getParameters();
+		parameters.gridType = i == 0 ? CollisionGridDense : CollisionGridHashed;
+		parameters.reorderInterval = 0;
+		parameters.deterministic = true;
+
+		// The dense grid drops particles below the floor, without gravity the bodies only hit each other
+		parameters.gravity = 0.f;
+
+		float btmLeftFront[3] = { -.3f, -1.5f, -.3f };
+		float topRightBack[3] = { i == 0 ? .9f : .1f, .9f, i == 0 ? .9f : .1f };
+		solvers[i]->setGrid(btmLeftFront, topRightBack, .01f);
+
+		// The cloud of bodies spreads from the middle of the dense grid
+		Emitter emitter = solvers[i]->getEmitters().getEmitter(0);
+		emitter.position[0] = .3f;
+		emitter.position[2] = .4f;
+		emitter.velocity[0] = .25f;
+		solvers[i]->setEmitter(0, emitter);
+	}
+
+	for (int step = 0; step < 60; step++) {
+		dense.step(TEST_TIME_STEP);
+		hashed.step(TEST_TIME_STEP);
+		if (hashed.getStateChecksum() != dense.getStateChecksum()) return false;
+	}
+
+	// Most bodies have to be outside of the bounds of the hashed grid, but inside of the ones of the dense grid
+	RigidBodyState const & state = hashed.getRigidBodyState();
+	unsigned int outside = 0u;
+	for (unsigned int body = 0; body < hashed.getSpawnedObjects(); body++) {
+		float x = state.position(ComponentX)[body], y = state.position(ComponentY)[body], z = state.position(ComponentZ)[body];
+		if (x < -.25f || y < -1.45f || z < -.25f || x > .85f || y > .85f || z > .85f) return false;
+		if (x > .1f || z > .1f) outside++;
+	}
+
+	return hashed.getLiveObjects() == 151u && outside > hashed.getSpawnedObjects() / 2;
+}
+
+/**
+* @brief Bodies of LARGE_BODY_PARTICLES or more particles are reduced in blocks. Their forces and torques are the serial sums of
+* the particle forces, apart from the rounding of the additions
+*/
+static bool testMomentaBlocks(void)
+{
+	// Cubes of 11x11x11 particles, split into six blocks each
+	std::vector<float> cube;
+	for (int x = 0; x < 11; x++) {
+		for (int y = 0; y < 11; y++) {
+			for (int z = 0; z < 11; z++) {
+				cube.push_back((x - 5) * .01f);
+				cube.push_back((y - 5) * .01f);
+				cube.push_back((z - 5) * .01f);
+			}
+		}
+	}
+	if (int(cube.size() / 3) < LARGE_BODY_PARTICLES) return false;
+
+	CpuSolver solver;
+	setupScene(solver, 12);
+	float inertiaTensor[9] = { 1e-2f, 0.f, 0.f, 0.f, 1e-2f, 0.f, 0.f, 0.f, 1e-2f };
+	solver.setModel(cube.data(), int(cube.size() / 3), inertiaTensor);
+	solver.burst(0, 12);
+	solver.setNumThreads(4);
+
+	// The bodies land on the floor and on each other
+	for (int step = 0; step < 90; step++) solver.step(TEST_TIME_STEP);
+
+	RigidBodyState const & state = solver.getRigidBodyState();
+	ParticleState const & particles = solver.getParticleState();
+	std::vector<unsigned int> const & offsets = solver.getBodyTypes().getBodyParticleOffsets();
+	std::vector<unsigned int> const & slots = solver.getParticleSlots();
+	bool contacts = false;
+
+	for (unsigned int body = 0; body < solver.getSpawnedObjects(); body++) {
+
+		double sums[6] = { 0.0, 0.0, 0.0, 0.0, 0.0, 0.0 }, bounds[6] = { 0.0, 0.0, 0.0, 0.0, 0.0, 0.0 };
+		for (unsigned int particleID = offsets[body]; particleID < offsets[body + 1]; particleID++) {
+			unsigned int slot = slots[particleID];
+
+			float force[3], relative[3];
+			for (int c = 0; c < 3; c++) {
+				force[c] = particles.force(c)[slot];
+				relative[c] = particles.relativePosition(c)[slot];
+			}
+			double momenta[6] = { force[0], force[1], force[2],
+				double(relative[1]) * force[2] - double(relative[2]) * force[1],
+				double(relative[2]) * force[0] - double(relative[0]) * force[2],
+				double(relative[0]) * force[1] - double(relative[1]) * force[0] };
+
+			for (int i = 0; i < 6; i++) {
+				sums[i] += momenta[i];
+				bounds[i] += std::abs(momenta[i]);
+			}
+			contacts = contacts || force[0] != 0.f;
+		}
+
+		for (int c = 0; c < 3; c++) {
+			if (std::abs(state.force(c)[body] - sums[c]) > 1e-5 * bounds[c] + 1e-9) return false;
+			if (std::abs(state.torque(c)[body] - sums[3 + c]) > 1e-5 * bounds[3 + c] + 1e-9) return false;
+		}
+	}
+
+	return solver.getSpawnedObjects() > 1u && contacts;
+}
+
+/**
+* @brief The fused stages give the states of the separate particle passes bit for bit. With a materialized particle state they
+* also write the relative positions and forces of the separate passes
+*/
+static bool testFusedStages(void)
+{
+	CpuSolver separate, fused, materialized;
+	CpuSolver * solvers[3] = { &separate, &fused, &materialized };
+
+	for (int i = 0; i < 3; i++) {
+		setupScene(*solvers[i], 150);
+
+		CpuSolverParameters & parameters = solvers[i]->getParameters();
+		parameters.deterministic = true;
+		parameters.sleeping = true;
+		parameters.fusedParticleStage = i > 0;
+		parameters.materializeParticleState = i == 2;
+	}
+
+	for (int step = 0; step < 200; step++) {
+		for (int i = 0; i < 3; i++) solvers[i]->step(TEST_TIME_STEP);
+
+		unsigned long long checksum = separate.computeStateChecksum();
+		if (fused.computeStateChecksum() != checksum || materialized.computeStateChecksum() != checksum) return false;
+	}
+
+	ParticleState const & expected = separate.getParticleState();
+	ParticleState const & actual = materialized.getParticleState();
+	for (int particle = 0; particle < separate.getNumParticles(); particle++) {
+		for (int c = 0; c < 3; c++) {
+			if (actual.force(c)[particle] != expected.force(c)[particle]) return false;
+			if (actual.relativePosition(c)[particle] != expected.relativePosition(c)[particle]) return false;
+		}
+	}
+
+	return separate.getLiveObjects() == 151u;
+}
+
+/**
+* @brief Bodies at rest fall asleep and stay where they are. A body flying into one of them wakes its island
+*/
+static bool testSleepWake(void)
+{
+	// Sleep states of getSleepingBodies() - see BODY_AWAKE in CpuSolver.cpp
+	const unsigned char awake = 0, asleep = 2;
+
+	// Without gravity and spawn velocities the bodies rest from the start
+	CpuSolver solver;
+	setupScene(solver, 20);
+
+	CpuSolverParameters & parameters = solver.getParameters();
+	parameters.gravity = 0.f;
+	parameters.sleeping = true;
+
+	Emitter emitter = solver.getEmitters().getEmitter(0);
+	emitter.velocity[0] = 0.f;
+	solver.setEmitter(0, emitter);
+
+	std::vector<unsigned char> const & sleepingBodies = solver.getSleepingBodies();
+	RigidBodyState const & state = solver.getRigidBodyState();
+
+	for (int step = 0; step < parameters.sleepSteps + 2; step++) solver.step(TEST_TIME_STEP);
+	if (solver.getLiveObjects() != 21u) return false;
+
+	unsigned int numBodies = solver.getSpawnedObjects();
+	std::vector<float> positions;
+	for (unsigned int body = 0; body < numBodies; body++) {
+		if (sleepingBodies[body] != asleep) return false;
+		for (int c = 0; c < 3; c++) positions.push_back(state.position(c)[body]);
+	}
+
+	// Sleeping bodies do not move
+	for (int step = 0; step < 60; step++) solver.step(TEST_TIME_STEP);
+
+	for (unsigned int body = 0; body < numBodies; body++) {
+		if (sleepingBodies[body] != asleep) return false;
+		for (int c = 0; c < 3; c++) {
+			if (state.position(c)[body] != positions[body * 3 + c]) return false;
+		}
+	}
+
+	// Another body is shot at body 1 along x
+	const unsigned int target = 1u;
+	Emitter shooter;
+	shooter.position[0] = state.position(ComponentX)[target] - .1f;
+	shooter.position[1] = state.position(ComponentY)[target];
+	shooter.position[2] = state.position(ComponentZ)[target];
+	shooter.rate = 0.f;
+	shooter.velocity[0] = 1.f;
+	parameters.numRigidBodies++;
+	solver.burst(solver.addEmitter(shooter), 1);
+
+	for (int step = 0; step < 30 && sleepingBodies[target] != awake; step++) solver.step(TEST_TIME_STEP);
+	if (sleepingBodies[target] != awake || solver.getLiveObjects() != 22u) return false;
+
+	// The woken body moves again
+	for (int step = 0; step < 10; step++) solver.step(TEST_TIME_STEP);
+
+	bool moved = false;
+	for (int c = 0; c < 3; c++) moved = moved || state.position(c)[target] != positions[target * 3 + c];
+	return moved;
+}
+
+/**
+* @brief The adaptive time step stays within minTimeStep and timeStep and changes by at most timeStepGrowth and timeStepShrink
+* per step. Fast bodies shorten it down to minTimeStep, once they left the grid it grows back to timeStep
+*/
+static bool testAdaptiveTimeStep(void)
+{
+	CpuSolver solver;
+	setupScene(solver, 20);
+
+	CpuSolverParameters & parameters = solver.getParameters();
+	parameters.adaptiveTimeStep = true;
+	parameters.minTimeStep = 1.f / 2000.f;
+	parameters.gravity = 0.f;
+	parameters.despawnOutsideGrid = true;
+
+	Emitter emitter = solver.getEmitters().getEmitter(0);
+	emitter.velocity[0] = 2.f;
+	solver.setEmitter(0, emitter);
+
+	float timeStep = solver.getTimeStep(), shortest = timeStep;
+	if (timeStep != parameters.timeStep) return false;
+
+	for (int step = 0; step < 1000; step++) {
+		solver.step(timeStep);
+
+		float next = solver.getTimeStep();
+		if (next < parameters.minTimeStep || next > parameters.timeStep) return false;
+		if (next < timeStep * parameters.timeStepShrink * (1.f - 1e-6f) || next > timeStep * parameters.timeStepGrowth * (1.f + 1e-6f)) return false;
+
+		timeStep = next;
+		shortest = std::min(shortest, timeStep);
+	}
+
+	return shortest == parameters.minTimeStep && timeStep == parameters.timeStep && solver.getLiveObjects() == 1u;
+}
+
+/**
+* @brief A free falling body drops as far as each integrator promises. RK2 and RK4 match the exact drop g t^2 / 2, the
+* semi-implicit Euler and Verlet integrators are one step ahead of it. The explicit Euler update of solver.frag replaces the
+* momenta every step, so the body falls at the speed a single step of gravity gives it
+*/
+static bool testIntegratorFreeFall(void)
+{
+	const int numSteps = 30;
+	IntegratorType integrators[5] = { IntegratorExplicitEuler, IntegratorSemiImplicitEuler, IntegratorVerlet, IntegratorRK2, IntegratorRK4 };
+
+	for (int i = 0; i < 5; i++) {
+		// Only the first body, far above the floor
+		CpuSolver solver;
+		setupScene(solver, 0);
+		solver.clearEmitters();
+
+		CpuSolverParameters & parameters = solver.getParameters();
+		parameters.integrator = integrators[i];
+		if (!solver.resetSimulation()) return false;
+
+		RigidBodyState const & state = solver.getRigidBodyState();
+		float start[3] = { state.position(ComponentX)[0], state.position(ComponentY)[0], state.position(ComponentZ)[0] };
+
+		for (int step = 0; step < numSteps; step++) solver.step(TEST_TIME_STEP);
+
+		double g = parameters.gravity, dt = TEST_TIME_STEP, n = numSteps;
+		double drop = integrators[i] == IntegratorExplicitEuler ? g * dt * dt * n
+			: integrators[i] == IntegratorSemiImplicitEuler || integrators[i] == IntegratorVerlet ? g * dt * dt * n * (n + 1.0) / 2.0
+			: g * (dt * n) * (dt * n) / 2.0;
+		double speed = integrators[i] == IntegratorExplicitEuler ? g * dt : g * dt * n;
+
+		if (solver.getLiveObjects() != 1u) return false;
+		if (std::abs(start[1] - state.position(ComponentY)[0] - drop) > 1e-5 * drop) return false;
+		if (std::abs(-state.linearMomentum(ComponentY)[0] / parameters.mass - speed) > 1e-5 * speed) return false;
+		if (state.position(ComponentX)[0] != start[0] || state.position(ComponentZ)[0] != start[2]) return false;
+	}
+
+	return true;
+}
+
+/**
+* @brief Bodies of several types follow the spawn sequence. The particle offsets of the bodies are the prefix sums of the
+* particle counts of their types, the particles and the particle streams point back to their bodies
+*/
+static bool testBodyTypes(void)
+{
+	CpuSolver solver;
+	setupScene(solver, 40);
+
+	// A rod of five particles and a single particle besides the cubes
+	float rod[15] = { -.02f, 0.f, 0.f, -.01f, 0.f, 0.f, 0.f, 0.f, 0.f, .01f, 0.f, 0.f, .02f, 0.f, 0.f };
+	float single[3] = { 0.f, 0.f, 0.f };
+	float inertiaTensor[9] = { 1e-3f, 0.f, 0.f, 0.f, 1e-3f, 0.f, 0.f, 0.f, 1e-3f };
+	if (solver.addBodyType(rod, 5, inertiaTensor, 2.f) != 1 || solver.addBodyType(single, 1, inertiaTensor, 0.f) != 2) return false;
+
+	std::vector<int> sequence = { 0, 1, 1, 2 };
+	if (!solver.setSpawnTypes(sequence) || solver.setSpawnTypes(std::vector<int>(1, 3))) return false;
+	solver.burst(0, 40);
+
+	for (int step = 0; step < 60; step++) solver.step(TEST_TIME_STEP);
+
+	CpuBodyTypes const & types = solver.getBodyTypes();
+	std::vector<unsigned int> const & bodyTypes = types.getBodyTypes();
+	std::vector<unsigned int> const & offsets = types.getBodyParticleOffsets();
+	std::vector<unsigned int> const & particleBodies = types.getParticleBodies();
+	std::vector<unsigned int> const & slots = solver.getParticleSlots();
+	Span<unsigned int const> streamBodies = solver.getParticleState().body();
+
+	unsigned int numBodies = solver.getSpawnedObjects();
+	if (numBodies != 41u || offsets[0] != 0u || offsets[numBodies] != unsigned(solver.getNumParticles())) return false;
+
+	int counts[3] = { 0, 0, 0 };
+	for (unsigned int body = 0; body < numBodies; body++) {
+		if (bodyTypes[body] != types.getSpawnType(body) || bodyTypes[body] != unsigned(sequence[body % sequence.size()])) return false;
+		if (offsets[body + 1] - offsets[body] != unsigned(types.getType(bodyTypes[body]).numParticles)) return false;
+		counts[bodyTypes[body]]++;
+
+		for (unsigned int particleID = offsets[body]; particleID < offsets[body + 1]; particleID++) {
+			if (particleBodies[particleID] != body || streamBodies[slots[particleID]] != body) return false;
+		}
+	}
+
+	return counts[0] == 11 && counts[1] == 20 && counts[2] == 10;
+}
+
+/**
+* @brief Despawned bodies wait on the free list and the next spawns reuse their slots, so the storage does not grow beyond the
+* live bodies. Compaction moves the live bodies into the holes, afterwards no despawned body is left. Both change the body layout
+*/
+static bool testBodyPool(void)
+{
+	// Sleep state of despawned bodies in getSleepingBodies() - see BODY_DESPAWNED in CpuSolver.cpp
+	const unsigned char despawned = 3;
+
+	CpuSolver solver;
+	setupScene(solver, 30);
+
+	// Bodies live half a second, the emitter keeps spawning new ones into the freed slots
+	CpuSolverParameters & parameters = solver.getParameters();
+	parameters.bodyLifetime = .5f;
+	parameters.compactInterval = 0;
+
+	Emitter emitter = solver.getEmitters().getEmitter(0);
+	emitter.rate = 60.f;
+	solver.setEmitter(0, emitter);
+
+	std::vector<unsigned char> const & sleepingBodies = solver.getSleepingBodies();
+	RigidBodyState const & state = solver.getRigidBodyState();
+	unsigned int layout = solver.getBodyLayout();
+
+	for (int step = 0; step < 240; step++) {
+		solver.step(TEST_TIME_STEP);
+
+		unsigned int numBodies = solver.getSpawnedObjects();
+		if (numBodies > unsigned(parameters.numRigidBodies) + 1u || solver.getBodyLayout() < layout) return false;
+
+		unsigned int live = 0u;
+		for (unsigned int body = 0; body < numBodies; body++) {
+			if (sleepingBodies[body] != despawned) {
+				live++;
+				continue;
+			}
+			for (int c = 0; c < 3; c++) {
+				if (state.linearMomentum(c)[body] != 0.f || state.angularMomentum(c)[body] != 0.f) return false;
+			}
+		}
+		if (live != solver.getLiveObjects()) return false;
+	}
+
+	// Slots were recycled
+	if (solver.getBodyLayout() == layout) return false;
+	layout = solver.getBodyLayout();
+
+	// Without spawns the bodies die off, compaction after every step leaves no holes
+	emitter.rate = 0.f;
+	solver.setEmitter(0, emitter);
+	parameters.compactInterval = 1;
+
+	for (int step = 0; step < 60; step++) {
+		solver.step(TEST_TIME_STEP);
+
+		unsigned int numBodies = solver.getSpawnedObjects();
+		if (solver.getLiveObjects() != numBodies || solver.getBodyLayout() < layout) return false;
+		if (std::count(sleepingBodies.begin(), sleepingBodies.begin() + numBodies, despawned) != 0) return false;
+		if (solver.getBodyTypes().getBodyParticleOffsets()[numBodies] != unsigned(solver.getNumParticles())) return false;
+	}
+
+	return solver.getBodyLayout() != layout && solver.getSpawnedObjects() < unsigned(parameters.numRigidBodies);
+}
+
+/**
+* @brief Emitters place their spawns clear of each other. Without gravity and emitter velocity nothing touches, so no two particles
+* of different bodies may ever be closer than one particle diameter
+*/
+static bool testEmitterOverlap(void)
+{
+	CpuSolver solver;
+	setupScene(solver, 200);
+
+	CpuSolverParameters & parameters = solver.getParameters();
+	parameters.gravity = 0.f;
+
+	Emitter emitter = solver.getEmitters().getEmitter(0);
+	emitter.extent[0] = emitter.extent[1] = emitter.extent[2] = .08f;
+	emitter.velocity[0] = 0.f;
+	solver.setEmitter(0, emitter);
+
+	for (int step = 0; step < 60; step++) solver.step(TEST_TIME_STEP);
+
+	// Spawns which found no room wait, but the box has room for more than a handful
+	if (solver.getLiveObjects() < 10u) return false;
+
+	ParticleState const & particles = solver.getParticleState();
+	int numParticles = solver.getNumParticles();
+	float minDistance = parameters.particleDiameter * (1.f - 1e-4f);
+
+	for (int a = 0; a < numParticles; a++) {
+		for (int b = a + 1; b < numParticles; b++) {
+			if (particles.body()[a] == particles.body()[b]) continue;
+
+			float distance2 = 0.f;
+			for (int c = 0; c < 3; c++) {
+				float delta = particles.position(c)[a] - particles.position(c)[b];
+				distance2 += delta * delta;
+			}
+			if (distance2 < minDistance * minDistance) return false;
+		}
+	}
+
+	return true;
+}
+
+
+/**
+* @brief A solver restored from a checkpoint continues bit for bit like the one which saved it - with sleeping, despawning and
+* compaction after the restore, so the body pool is part of the state
+*/
+static bool testCheckpointRestore(void)
+{
+	std::string path = "RigidSolverCPUTest.ckpt";
+
+	CpuSolver saved, restored;
+	CpuSolver * solvers[2] = { &saved, &restored };
+	for (int i = 0; i < 2; i++) {
+		setupScene(*solvers[i], 100);
+		CpuSolverParameters & parameters = solvers[i]->getParameters();
+		parameters.sleeping = true;
+		parameters.bodyLifetime = 1.f;
+		parameters.compactInterval = 20;
+	}
+
+	for (int step = 0; step < 90; step++) saved.step(TEST_TIME_STEP);
+	if (!saved.saveCheckpoint(path)) return false;
+
+	bool loaded = restored.loadCheckpoint(path);
+	std::remove(path.c_str());
+	if (!loaded || restored.computeStateChecksum() != saved.computeStateChecksum()) return false;
+
+	for (int step = 0; step < 90; step++) {
+		saved.step(TEST_TIME_STEP);
+		restored.step(TEST_TIME_STEP);
+		if (restored.computeStateChecksum() != saved.computeStateChecksum()) return false;
+	}
+
+	return restored.getLiveObjects() == saved.getLiveObjects();
+}
+
+
+/**
+* @brief A checkpoint whose capacity disagrees with its body types or exceeds CHECKPOINT_MAX_BODIES is rejected before anything is
+* allocated, and the solver keeps its state
+*/
+static bool testCheckpointCapacity(void)
+{
+	std::string path = "RigidSolverCPUTest.ckpt";
+
+	CpuSolver saved, restored;
+	setupScene(saved, 20);
+	setupScene(restored, 20);
+	for (int step = 0; step < 10; step++) saved.step(TEST_TIME_STEP);
+	if (!saved.saveCheckpoint(path)) return false;
+
+	std::vector<unsigned char> file;
+	std::FILE * stream = std::fopen(path.c_str(), "rb");
+	if (stream != NULL) {
+		unsigned char buffer[4096];
+		for (size_t bytes; (bytes = std::fread(buffer, 1, sizeof(buffer), stream)) > 0;) file.insert(file.end(), buffer, buffer + bytes);
+		std::fclose(stream);
+	}
+
+	// The file header and the header of the first section, the solver state, take 64 bytes each
+	size_t offset = 128 + offsetof(CheckpointSolverState, capacity);
+	if (file.size() < offset + sizeof(unsigned int)) return false;
+
+	unsigned int capacity;
+	std::memcpy(&capacity, &file[offset], sizeof(capacity));
+	unsigned int corrupt[3] = { capacity + 1u, CHECKPOINT_MAX_BODIES + 1u, 0xFFFFFFFFu };
+
+	unsigned long long checksum = restored.computeStateChecksum();
+	bool rejected = true;
+
+	for (int i = 0; i < 3 && rejected; i++) {
+		std::memcpy(&file[offset], &corrupt[i], sizeof(capacity));
+		stream = std::fopen(path.c_str(), "wb");
+		if (stream == NULL || std::fwrite(file.data(), 1, file.size(), stream) != file.size()) rejected = false;
+		if (stream != NULL) std::fclose(stream);
+
+		rejected = rejected && !restored.loadCheckpoint(path) && restored.computeStateChecksum() == checksum;
+	}
+
+	// The intact checkpoint still loads
+	std::memcpy(&file[offset], &capacity, sizeof(capacity));
+	stream = std::fopen(path.c_str(), "wb");
+	bool written = stream != NULL && std::fwrite(file.data(), 1, file.size(), stream) == file.size();
+	if (stream != NULL) std::fclose(stream);
+
+	bool loaded = written && restored.loadCheckpoint(path);
+	std::remove(path.c_str());
+
+	return rejected && loaded && restored.computeStateChecksum() == saved.computeStateChecksum();
+}
+
+/**
+* @brief A recording decodes to the recorded poses within the quantization, read in order and seeking backwards through the blocks
+*/
+static bool testTrajectoryRoundTrip(void)
+{
+	std::string path = "RigidSolverCPUTest.trj";
+
+	CpuSolver solver;
+	setupScene(solver, 100);
+
+	TrajectoryOptions options;
+	options.framesPerBlock = 16;
+
+	TrajectoryWriter writer;
+	if (!writer.open(path, options)) return false;
+
+	// Poses of every frame, seven values per body
+	std::vector<std::vector<float> > recorded;
+	int numFrames = 120;
+
+	for (int frame = 0; frame < numFrames; frame++) {
+		solver.step(TEST_TIME_STEP);
+		if (!solver.writeTrajectoryFrame(writer, (frame + 1) * double(TEST_TIME_STEP))) return false;
+
+		RigidBodyState const & state = solver.getRigidBodyState();
+		std::vector<float> poses;
+		for (unsigned int body = 0; body < solver.getSpawnedObjects(); body++) {
+			for (int c = 0; c < 3; c++) poses.push_back(state.position(c)[body]);
+			for (int c = 0; c < 4; c++) poses.push_back(state.quaternion(c)[body]);
+		}
+		recorded.push_back(poses);
+	}
+	if (!writer.close()) return false;
+
+	TrajectoryReader reader;
+	if (!reader.open(path) || reader.getNumFrames() != (unsigned long long)numFrames) return false;
+
+	// Half a quantization step plus the rounding of the floats
+	float positionTolerance = options.positionQuantum / 2.f + 1e-6f;
+	float quaternionTolerance = 1e-4f;
+	bool matches = true;
+
+	for (int pass = 0; pass < 2 && matches; pass++) {
+		for (int i = 0; i < numFrames && matches; i++) {
+			int frame = pass == 0 ? i : numFrames - 1 - i;
+
+			TrajectoryPoses poses;
+			std::vector<float> const & expected = recorded[frame];
+			if (!reader.readFrame((unsigned long long)frame, poses) || poses.numBodies * 7 != expected.size()) {
+				matches = false;
+				break;
+			}
+
+			for (unsigned int body = 0; body < poses.numBodies && matches; body++) {
+				float const * pose = &expected[body * 7];
+				for (int c = 0; c < 3; c++) matches = matches && std::abs(poses.position[c][body] - pose[c]) <= positionTolerance;
+
+				// q and -q are the same rotation
+				float dot = 0.f;
+				for (int c = 0; c < 4; c++) dot += poses.quaternion[c][body] * pose[3 + c];
+				float sign = dot < 0.f ? -1.f : 1.f;
+				for (int c = 0; c < 4; c++) matches = matches && std::abs(sign * poses.quaternion[c][body] - pose[3 + c]) <= quaternionTolerance;
+			}
+		}
+	}
+
+	reader.close();
+	std::remove(path.c_str());
+	return matches;
+}
+
+
+/**
+* @brief The deterministic mode ends in the same state on 1, 2 and 4 threads
+*/
+static bool testDeterministicChecksum(void)
+{
+	unsigned long long reference = 0ull;
+
+	for (int numThreads = 1; numThreads <= 4; numThreads *= 2) {
+		CpuSolver solver;
+		setupScene(solver, 150);
+		solver.getParameters().deterministic = true;
+		solver.setNumThreads(numThreads);
+
+		for (int step = 0; step < 200; step++) solver.step(TEST_TIME_STEP);
+
+		unsigned long long checksum = solver.getStateChecksum();
+		if (checksum == 0ull || checksum != solver.computeStateChecksum()) return false;
+
+		if (numThreads == 1) reference = checksum;
+		else if (checksum != reference) return false;
+	}
+
+	return true;
+}
+
+// Tests by name - ctest runs each of them on its own, without an argument all of them run
+struct SolverTest {
+	char const * name;
+	bool (*run)(void);
+};
+
+static const SolverTest TESTS[] = {
+	{ "contactKernelISAs", testContactKernelISAs },
+	{ "hashedGrid", testHashedGrid },
+	{ "momentaBlocks", testMomentaBlocks },
+	{ "fusedStages", testFusedStages },
+	{ "sleepWake", testSleepWake },
+	{ "adaptiveTimeStep", testAdaptiveTimeStep },
+	{ "integratorFreeFall", testIntegratorFreeFall },
+	{ "bodyTypes", testBodyTypes },
+	{ "bodyPool", testBodyPool },
+	{ "emitterOverlap", testEmitterOverlap },
+	{ "checkpointRestore", testCheckpointRestore },
+	{ "checkpointCapacity", testCheckpointCapacity },
+	{ "trajectoryRoundTrip", testTrajectoryRoundTrip },
+	{ "deterministicChecksum", testDeterministicChecksum },
+};
+
+int main(int argc, char ** argv)
+{
+	int failed = 0, run = 0;
+
+	for (size_t test = 0; test < sizeof(TESTS) / sizeof(TESTS[0]); test++) {
+		if (argc > 1 && std::string(argv[1]) != TESTS[test].name) continue;
+
+		bool passed = TESTS[test].run();
+		std::printf("%s %s\n", passed ? "PASS" : "FAIL", TESTS[test].name);
+		failed += passed ? 0 : 1;
+		run++;
+	}
+
+	// An unknown name must not pass silently
+	if (run == 0) {
+		std::fprintf(stderr, "Unknown test %s\n", argv[1]);
+		return EXIT_FAILURE;
+	}
+
+	return failed;
+}
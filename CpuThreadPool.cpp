@@ -0,0 +1,178 @@
+#include "CpuThreadPool.h"
+#include <algorithm>
+
+CpuThreadPool::CpuThreadPool()
+{
+	setNumThreads(0);
+}
+
+
+CpuThreadPool::~CpuThreadPool()
+{
+	stopWorkers();
+}
+
+/**
+* @brief Sets the number of threads including the calling one. 0 uses one thread per hardware thread
+*/
+void CpuThreadPool::setNumThreads(int numThreads)
+{
+	if (numThreads <= 0) numThreads = int(std::thread::hardware_concurrency());
+
+	stopWorkers();
+	this->numThreads = std::max(numThreads, 1);
+	startWorkers();
+}
+
+/** @brief Returns the number of threads including the calling one
+*/
+int CpuThreadPool::getNumThreads(void) const
+{
+	return numThreads;
+}
+
+/**
+* @brief Calls function for the blocks of [begin, end) on all threads and returns when every block is processed
+* @param begin		First index of the range
+* @param end		Index behind the last one of the range
+* @param blockSize	Number of indices per block - the unit of work which is stolen
+* @param function	Called with the range of a block and the index of the executing thread
+*/
+void CpuThreadPool::parallelFor(int begin, int end, int blockSize, BlockFunction const & function)
+{
+	if (end <= begin) return;
+
+	blockSize = std::max(blockSize, 1);
+	int numBlocks = (end - begin + blockSize - 1) / blockSize;
+
+	// Not worth waking anyone up
+	if (numThreads == 1 || numBlocks == 1) {
+		for (int first = begin; first < end; first += blockSize) function(first, std::min(first + blockSize, end), 0);
+		return;
+	}
+
+	// The job is published before the first block, so no block is ever queued without it
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		job = &function;
+	}
+
+	// Every thread starts on a contiguous share of the blocks
+	for (int thread = 0; thread < numThreads; thread++) {
+
+		int firstBlock = int((long long)(numBlocks) * thread / numThreads);
+		int lastBlock = int((long long)(numBlocks) * (thread + 1) / numThreads);
+
+		std::lock_guard<std::mutex> queueLock(queues[thread]->mutex);
+		for (int block = firstBlock; block < lastBlock; block++) {
+			Block range = { begin + block * blockSize, std::min(begin + (block + 1) * blockSize, end) };
+			queues[thread]->blocks.push_back(range);
+		}
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		busyWorkers = int(workers.size());
+		generation++;
+	}
+	jobAvailable.notify_all();
+
+	processBlocks(0, function);
+
+	std::unique_lock<std::mutex> lock(mutex);
+	jobFinished.wait(lock, [this] { return busyWorkers == 0; });
+	job = NULL;
+}
+
+/** @brief Spawns numThreads - 1 workers and their block queues
+*/
+void CpuThreadPool::startWorkers(void)
+{
+	unsigned int currentGeneration;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = false;
+		currentGeneration = generation;
+	}
+
+	// New workers start at the current generation, otherwise the generation of the last job would wake them without a job
+	for (int thread = 0; thread < numThreads; thread++) queues.push_back(new BlockQueue());
+	for (int thread = 1; thread < numThreads; thread++) workers.push_back(std::thread(&CpuThreadPool::workerLoop, this, thread, currentGeneration));
+}
+
+/** @brief Joins the workers and releases the block queues
+*/
+void CpuThreadPool::stopWorkers(void)
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+	}
+	jobAvailable.notify_all();
+
+	for (size_t i = 0; i < workers.size(); i++) workers[i].join();
+	workers.clear();
+
+	for (size_t i = 0; i < queues.size(); i++) delete queues[i];
+	queues.clear();
+}
+
+/**
+* @brief Main loop of a worker: waits for a job, processes blocks until all queues are empty and reports back
+* @param lastGeneration	Generation of the last job before the worker was started
+*/
+void CpuThreadPool::workerLoop(int thread, unsigned int lastGeneration)
+{
+	while (true) {
+
+		std::unique_lock<std::mutex> lock(mutex);
+		jobAvailable.wait(lock, [&] { return stopping || generation != lastGeneration; });
+		if (stopping) return;
+
+		lastGeneration = generation;
+		BlockFunction const * function = job;
+		lock.unlock();
+
+		processBlocks(thread, *function);
+
+		lock.lock();
+		if (--busyWorkers == 0) jobFinished.notify_all();
+	}
+}
+
+/** @brief Runs the current job on blocks of the own queue first and of the other queues afterwards
+*/
+void CpuThreadPool::processBlocks(int thread, BlockFunction const & function)
+{
+	Block block;
+	while (popBlock(thread, block)) function(block.begin, block.end, thread);
+}
+
+/**
+* @brief Takes the next block from the front of the own queue. If it is empty a block is stolen from the back of another
+* queue - the end which is furthest away from the blocks its owner is working on. Returns false if all queues are empty
+*/
+bool CpuThreadPool::popBlock(int thread, Block & block)
+{
+	{
+		BlockQueue & own = *queues[thread];
+		std::lock_guard<std::mutex> lock(own.mutex);
+		if (!own.blocks.empty()) {
+			block = own.blocks.front();
+			own.blocks.pop_front();
+			return true;
+		}
+	}
+
+	for (int i = 1; i < numThreads; i++) {
+		BlockQueue & victim = *queues[(thread + i) % numThreads];
+		std::lock_guard<std::mutex> lock(victim.mutex);
+		if (!victim.blocks.empty()) {
+			block = victim.blocks.back();
+			victim.blocks.pop_back();
+			return true;
+		}
+	}
+
+	return false;
+}
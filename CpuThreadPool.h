@@ -0,0 +1,60 @@
+#pragma once
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Processes the blocks [begin, end) of a parallelFor. thread is the index of the executing thread, 0 is the calling thread
+typedef std::function<void(int begin, int end, int thread)> BlockFunction;
+
+// Thread pool with one block queue per thread. A parallelFor hands every thread a contiguous share of the blocks,
+// threads which run out of work steal blocks from the back of the other queues so clustered regions do not stall the pass.
+// The calling thread takes part as thread 0
+class CpuThreadPool
+{
+public:
+	CpuThreadPool();
+	~CpuThreadPool();
+
+	void setNumThreads(int numThreads);
+	int getNumThreads(void) const;
+
+	void parallelFor(int begin, int end, int blockSize, BlockFunction const & function);
+
+private:
+	CpuThreadPool(const CpuThreadPool &);
+	CpuThreadPool & operator=(const CpuThreadPool &);
+
+	struct Block {
+		int begin;
+		int end;
+	};
+
+	struct BlockQueue {
+		std::mutex mutex;
+		std::deque<Block> blocks;
+	};
+
+	void startWorkers(void);
+	void stopWorkers(void);
+	void workerLoop(int thread, unsigned int lastGeneration);
+	void processBlocks(int thread, BlockFunction const & function);
+	bool popBlock(int thread, Block & block);
+
+	int numThreads = 1;
+
+	std::vector<std::thread> workers;
+	std::vector<BlockQueue *> queues;
+
+	// Job handed to the workers - guarded by mutex
+	std::mutex mutex;
+	std::condition_variable jobAvailable;
+	std::condition_variable jobFinished;
+	BlockFunction const * job = NULL;
+	unsigned int generation = 0;
+	int busyWorkers = 0;
+	bool stopping = false;
+
+};
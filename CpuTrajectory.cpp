@@ -0,0 +1,775 @@
+#include "CpuTrajectory.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+// The file header takes one cache line like the one of a checkpoint
+static const size_t TRAJECTORY_HEADER_SIZE = 64;
+static const char TRAJECTORY_MAGIC[8] = { 'R', 'S', 'O', 'L', 'V', 'T', 'R', 'J' };
+static const char TRAJECTORY_INDEX_MAGIC[8] = { 'R', 'S', 'O', 'L', 'V', 'I', 'D', 'X' };
+static const char TRAJECTORY_BLOCK_MAGIC[4] = { 'B', 'L', 'C', 'K' };
+
+// Written as a number, read back in another byte order it does not match
+static const unsigned int TRAJECTORY_BYTE_ORDER = 0x01020304u;
+
+// Positions, largest quaternion component and the three others
+static const int TRAJECTORY_STREAMS = 7;
+
+// Largest quantized position - beyond it the zigzag residuals could overflow
+static const double TRAJECTORY_POSITION_LIMIT = 1e15;
+
+struct TrajectoryFileHeader {
+	char magic[8];
+	unsigned int version;
+	unsigned int byteOrder;
+	float positionQuantum;
+	int quaternionBits;
+	int framesPerBlock;
+	unsigned int reserved[9];
+};
+
+// Precedes the encoded frames of a block. Scanning the block headers restores the index of a file which was not closed
+struct TrajectoryBlockHeader {
+	char magic[4];
+	unsigned int bytes; // Encoded frames behind the header
+	unsigned int numFrames;
+	unsigned int layout; // TrajectoryFrame::layout of all frames of the block
+	unsigned long long firstFrame;
+	double firstTime;
+};
+
+// Last bytes of a closed file, behind the index of the blocks
+struct TrajectoryFooter {
+	char magic[8];
+	unsigned long long indexOffset;
+	unsigned long long numBlocks;
+	unsigned long long numFrames;
+};
+
+static_assert(sizeof(TrajectoryFileHeader) == TRAJECTORY_HEADER_SIZE, "The file header has to fill one cache line");
+static_assert(sizeof(TrajectoryBlockHeader) == 32, "The block header must not be padded");
+static_assert(sizeof(TrajectoryFooter) == 32, "The footer must not be padded");
+static_assert(sizeof(TrajectoryBlock) == 32, "The index entries must not be padded");
+
+// Most bodies a frame may claim - larger counts are taken for a corrupted file instead of being allocated
+static const unsigned long long TRAJECTORY_MAX_BODIES = 1ull << 26;
+
+/** @brief Appends v in groups of 7 bits, the lowest first. The high bit of a byte tells that another one follows
+*/
+static void appendVarint(std::vector<unsigned char> & bytes, unsigned long long v)
+{
+	while (v >= 0x80ull) {
+		bytes.push_back((unsigned char)(v | 0x80ull));
+		v >>= 7;
+	}
+	bytes.push_back((unsigned char)(v));
+}
+
+/**
+* @brief Reads a number written by appendVarint() at cursor and moves the cursor behind it. Returns false if the number runs past
+* end or does not fit into 64 bits
+*/
+static bool readVarint(unsigned char const * data, size_t & cursor, size_t end, unsigned long long & v)
+{
+	v = 0ull;
+	for (int shift = 0; shift < 64; shift += 7) {
+		if (cursor >= end) return false;
+
+		unsigned char byte = data[cursor++];
+		v |= (unsigned long long)(byte & 0x7F) << shift;
+		if ((byte & 0x80) == 0) return true;
+	}
+	return false;
+}
+
+/** @brief Maps residuals of small magnitude to small numbers: 0, -1, 1, -2, ... become 0, 1, 2, 3, ...
+*/
+static unsigned long long zigzag(long long v)
+{
+	return (unsigned long long)(v) << 1 ^ (unsigned long long)(v >> 63);
+}
+
+/** @brief Inverse of zigzag()
+*/
+static long long unzigzag(unsigned long long v)
+{
+	return (long long)(v >> 1) ^ -(long long)(v & 1ull);
+}
+
+/** @brief Quantizes a position component to multiples of quantum. Positions which are not finite are stored as 0
+*/
+static long long quantizePosition(float position, float quantum)
+{
+	double steps = double(position) / double(quantum);
+	if (!(std::abs(steps) < TRAJECTORY_POSITION_LIMIT)) return 0ll;
+
+	return std::llround(steps);
+}
+
+/**
+* @brief Quantizes a quaternion to the index of its largest component and the three others. q and -q are the same rotation, so the
+* largest component is made positive and restored from the unit length. The others lie within +-1/sqrt(2)
+* @param out	Index of the largest component and the three others in their order
+*/
+static void quantizeQuaternion(float const * q, int bits, long long * out)
+{
+	float length = std::sqrt(q[0] * q[0] + q[1] * q[1] + q[2] * q[2] + q[3] * q[3]);
+
+	// Degenerate quaternions become the identity
+	if (!(length > 0.f) || !std::isfinite(length)) {
+		for (int c = 0; c < 4; c++) out[c] = 0ll;
+		return;
+	}
+
+	int largest = 0;
+	for (int c = 1; c < 4; c++) {
+		if (std::abs(q[c]) > std::abs(q[largest])) largest = c;
+	}
+
+	float maxValue = float((1 << (bits - 1)) - 1);
+	float scale = 1.41421356f / (q[largest] < 0.f ? -length : length);
+
+	out[0] = largest;
+	for (int c = 0, component = 1; c < 4; c++) {
+		if (c != largest) out[component++] = std::llround(std::max(-1.f, std::min(q[c] * scale, 1.f)) * maxValue);
+	}
+}
+
+/**
+* @brief Inverse of quantizeQuaternion(). The largest component is restored from the unit length
+* @param in	Index of the largest component and the three others
+*/
+static void restoreQuaternion(long long const * in, int bits, float * q)
+{
+	float scale = 1.f / (float((1 << (bits - 1)) - 1) * 1.41421356f);
+	int largest = int(in[0] & 3);
+
+	float sum = 0.f;
+	for (int c = 0, component = 1; c < 4; c++) {
+		if (c == largest) continue;
+		q[c] = float(in[component++]) * scale;
+		sum += q[c] * q[c];
+	}
+	q[largest] = std::sqrt(std::max(1.f - sum, 0.f));
+}
+
+// --------------------------------------------------
+//  Writer
+// --------------------------------------------------
+
+TrajectoryWriter::TrajectoryWriter()
+{
+}
+
+
+TrajectoryWriter::~TrajectoryWriter()
+{
+	close();
+}
+
+/**
+* @brief Creates the file, writes its header and starts the writer thread. Returns false if the options are out of range or the
+* file can not be created
+*/
+bool TrajectoryWriter::open(std::string const & path, TrajectoryOptions const & options)
+{
+	close();
+
+	if (!(options.positionQuantum > 0.f) || options.quaternionBits < 2 || options.quaternionBits > 24) return false;
+	if (options.framesPerBlock < 1 || options.maxPendingFrames < 1) return false;
+
+	file = std::fopen(path.c_str(), "wb");
+	if (file == NULL) return false;
+
+	this->options = options;
+
+	TrajectoryFileHeader header;
+	std::memset(&header, 0, sizeof(header));
+	std::memcpy(header.magic, TRAJECTORY_MAGIC, sizeof(header.magic));
+	header.version = TRAJECTORY_VERSION;
+	header.byteOrder = TRAJECTORY_BYTE_ORDER;
+	header.positionQuantum = options.positionQuantum;
+	header.quaternionBits = options.quaternionBits;
+	header.framesPerBlock = options.framesPerBlock;
+
+	fileOffset = 0ull;
+	if (!writeBytes(&header, sizeof(header))) {
+		std::fclose(file);
+		file = NULL;
+		return false;
+	}
+
+	block.clear();
+	blocks.clear();
+	numFrames = 0ull;
+	blockFrames = 0u;
+	historyBodies[0] = historyBodies[1] = 0u;
+
+	stats = TrajectoryStats();
+	stats.fileBytes = fileOffset;
+	closing = false;
+	failed = false;
+
+	writer = std::thread(&TrajectoryWriter::writerLoop, this);
+
+	return true;
+}
+
+/**
+* @brief Queues the poses of a frame for the writer thread. Waits while maxPendingFrames frames are queued, so a slow disk slows
+* down the simulation instead of filling the memory. Returns false if no file is open or a write failed
+*/
+bool TrajectoryWriter::writeFrame(TrajectoryFrame const & frame)
+{
+	if (file == NULL) return false;
+
+	std::vector<float> poses;
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+		bufferAvailable.wait(lock, [this] { return pending.size() < size_t(options.maxPendingFrames) || failed; });
+		if (failed) return false;
+
+		if (!spareBuffers.empty()) {
+			poses.swap(spareBuffers.back());
+			spareBuffers.pop_back();
+		}
+	}
+
+	// The copy is all the caller pays for, quantizing and encoding run on the writer thread
+	size_t numBodies = frame.numBodies;
+	poses.resize(TRAJECTORY_STREAMS * numBodies);
+
+	for (int c = 0; c < 3; c++) {
+		float * out = poses.data() + c * numBodies;
+		for (size_t body = 0; body < numBodies; body++) out[body] = frame.position[c][body * frame.positionStride];
+	}
+	for (int c = 0; c < 4; c++) {
+		float * out = poses.data() + (3 + c) * numBodies;
+		for (size_t body = 0; body < numBodies; body++) out[body] = frame.quaternion[c][body * frame.quaternionStride];
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		pending.push_back(PendingFrame());
+		pending.back().time = frame.time;
+		pending.back().numBodies = frame.numBodies;
+		pending.back().layout = frame.layout;
+		pending.back().poses.swap(poses);
+
+		stats.frames++;
+		stats.rawBytes += TRAJECTORY_STREAMS * sizeof(float) * numBodies;
+	}
+	frameAvailable.notify_one();
+
+	return true;
+}
+
+/**
+* @brief Waits for the writer thread to encode the queued frames, writes the last block and the index and closes the file. Returns
+* false if no file was open or any write failed
+*/
+bool TrajectoryWriter::close(void)
+{
+	if (file == NULL) return false;
+
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		closing = true;
+	}
+	frameAvailable.notify_all();
+	writer.join();
+
+	bool written = !failed;
+
+	if (written && blockFrames > 0u) {
+		flushBlock();
+		written = !failed;
+	}
+
+	// Index of the blocks and the footer which points to it
+	if (written) {
+		TrajectoryFooter footer;
+		std::memcpy(footer.magic, TRAJECTORY_INDEX_MAGIC, sizeof(footer.magic));
+		footer.indexOffset = fileOffset;
+		footer.numBlocks = blocks.size();
+		footer.numFrames = numFrames;
+
+		written = writeBytes(blocks.data(), blocks.size() * sizeof(TrajectoryBlock)) && writeBytes(&footer, sizeof(footer));
+	}
+
+	written = std::fclose(file) == 0 && written;
+	file = NULL;
+
+	pending.clear();
+	spareBuffers.clear();
+	block.clear();
+	blocks.clear();
+	for (int frame = 0; frame < 2; frame++) history[frame].clear();
+	stats.fileBytes = fileOffset;
+
+	return written;
+}
+
+/** @brief Tells whether a recording is open
+*/
+bool TrajectoryWriter::isOpen(void) const
+{
+	return file != NULL;
+}
+
+/** @brief Returns the frames and bytes of the recording so far
+*/
+TrajectoryStats TrajectoryWriter::getStats(void)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	return stats;
+}
+
+/**
+* @brief Writer thread: encodes the queued frames in order and writes the blocks until close() is called and the queue is empty
+*/
+void TrajectoryWriter::writerLoop(void)
+{
+	PendingFrame frame;
+
+	for (;;) {
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+
+			// Hands the buffer of the last frame back to writeFrame()
+			if (frame.poses.capacity() > 0) {
+				spareBuffers.push_back(std::vector<float>());
+				spareBuffers.back().swap(frame.poses);
+			}
+			stats.fileBytes = fileOffset;
+			bufferAvailable.notify_one();
+
+			frameAvailable.wait(lock, [this] { return !pending.empty() || closing; });
+			if (pending.empty()) return;
+
+			frame.time = pending.front().time;
+			frame.numBodies = pending.front().numBodies;
+			frame.layout = pending.front().layout;
+			frame.poses.swap(pending.front().poses);
+			pending.pop_front();
+
+			// Frames behind a failed write are dropped
+			if (failed) continue;
+		}
+
+		encodeFrame(frame);
+	}
+}
+
+/**
+* @brief Appends the residuals of a frame to the block and writes the block once it holds framesPerBlock frames
+*/
+void TrajectoryWriter::encodeFrame(PendingFrame const & frame)
+{
+	size_t numBodies = frame.numBodies;
+	float const * poses = frame.poses.data();
+
+	// Bodies changed their indices - the prediction from the last frames would mix them up
+	if (blockFrames > 0u && frame.layout != blockLayout) flushBlock();
+
+	if (blockFrames == 0u) {
+		blockTime = frame.time;
+		blockLayout = frame.layout;
+	}
+
+	// Quantized streams
+	quantized.resize(TRAJECTORY_STREAMS * numBodies);
+	for (int c = 0; c < 3; c++) {
+		for (size_t body = 0; body < numBodies; body++) {
+			quantized[c * numBodies + body] = quantizePosition(poses[c * numBodies + body], options.positionQuantum);
+		}
+	}
+	for (size_t body = 0; body < numBodies; body++) {
+		float q[4];
+		long long smallestThree[4];
+		for (int c = 0; c < 4; c++) q[c] = poses[(3 + c) * numBodies + body];
+
+		quantizeQuaternion(q, options.quaternionBits, smallestThree);
+		for (int c = 0; c < 4; c++) quantized[(3 + c) * numBodies + body] = smallestThree[c];
+	}
+
+	// Frame header
+	appendVarint(block, numBodies);
+	unsigned char time[sizeof(double)];
+	std::memcpy(time, &frame.time, sizeof(time));
+	block.insert(block.end(), time, time + sizeof(time));
+
+	// Residuals against the prediction from the last frames of the block. Bodies which did not exist in a frame are predicted as 0
+	unsigned int lastBodies = blockFrames > 0u ? historyBodies[0] : 0u;
+	unsigned int secondLastBodies = blockFrames > 1u ? historyBodies[1] : 0u;
+	unsigned long long zeros = 0ull;
+
+	for (int stream = 0; stream < TRAJECTORY_STREAMS; stream++) {
+
+		// Positions move steadily and are extrapolated linearly, the quaternion components jump whenever the largest one changes
+		bool linear = stream < 3;
+
+		for (size_t body = 0; body < numBodies; body++) {
+
+			long long prediction = 0ll;
+			if (body < lastBodies) {
+				long long last = history[0][stream * size_t(lastBodies) + body];
+				prediction = linear && body < secondLastBodies ? 2 * last - history[1][stream * size_t(secondLastBodies) + body] : last;
+			}
+
+			unsigned long long residual = zigzag(quantized[stream * numBodies + body] - prediction);
+
+			// Runs of zeros are stored as a 0 and the length of the run minus one
+			if (residual == 0ull) {
+				zeros++;
+				continue;
+			}
+			if (zeros > 0ull) {
+				appendVarint(block, 0ull);
+				appendVarint(block, zeros - 1ull);
+				zeros = 0ull;
+			}
+			appendVarint(block, residual);
+		}
+	}
+	if (zeros > 0ull) {
+		appendVarint(block, 0ull);
+		appendVarint(block, zeros - 1ull);
+	}
+
+	history[1].swap(history[0]);
+	history[0].swap(quantized);
+	historyBodies[1] = historyBodies[0];
+	historyBodies[0] = frame.numBodies;
+
+	numFrames++;
+	blockFrames++;
+	if (blockFrames == unsigned(options.framesPerBlock)) flushBlock();
+}
+
+/**
+* @brief Writes the block with its header and adds it to the index. The next frame starts a new block with a key frame
+*/
+void TrajectoryWriter::flushBlock(void)
+{
+	TrajectoryBlockHeader header;
+	std::memcpy(header.magic, TRAJECTORY_BLOCK_MAGIC, sizeof(header.magic));
+	header.bytes = unsigned(block.size());
+	header.numFrames = blockFrames;
+	header.layout = blockLayout;
+	header.firstFrame = numFrames - blockFrames;
+	header.firstTime = blockTime;
+
+	TrajectoryBlock entry;
+	entry.offset = fileOffset;
+	entry.firstFrame = header.firstFrame;
+	entry.numFrames = header.numFrames;
+	entry.bytes = header.bytes;
+	entry.firstTime = header.firstTime;
+
+	if (writeBytes(&header, sizeof(header)) && writeBytes(block.data(), block.size())) blocks.push_back(entry);
+
+	block.clear();
+	blockFrames = 0u;
+}
+
+/**
+* @brief Appends the bytes to the file. A failed write is remembered, writeFrame() and close() report it
+*/
+bool TrajectoryWriter::writeBytes(void const * data, size_t bytes)
+{
+	if (bytes > 0 && std::fwrite(data, bytes, 1, file) != 1) {
+		std::lock_guard<std::mutex> lock(mutex);
+		failed = true;
+		bufferAvailable.notify_all();
+		return false;
+	}
+
+	fileOffset += bytes;
+	return true;
+}
+
+// --------------------------------------------------
+//  Reader
+// --------------------------------------------------
+
+TrajectoryReader::TrajectoryReader()
+{
+}
+
+
+TrajectoryReader::~TrajectoryReader()
+{
+}
+
+/**
+* @brief Maps a recording and reads its block index. Returns false if it is no recording or has another version or byte order
+* @param prefetchBlocks	Blocks behind the one in hand which are read in the background
+*/
+bool TrajectoryReader::open(std::string const & path, int prefetchBlocks)
+{
+	close();
+
+	// A recording may be far larger than the memory, its blocks are fetched as they are needed
+	if (!file.open(path, false)) return false;
+
+	TrajectoryFileHeader header;
+	if (file.size() < sizeof(header)) {
+		close();
+		return false;
+	}
+	std::memcpy(&header, file.data(), sizeof(header));
+
+	bool valid = std::memcmp(header.magic, TRAJECTORY_MAGIC, sizeof(header.magic)) == 0 && header.version == TRAJECTORY_VERSION
+		&& header.byteOrder == TRAJECTORY_BYTE_ORDER && header.positionQuantum > 0.f && header.quaternionBits >= 2 && header.quaternionBits <= 24;
+	if (!valid) {
+		close();
+		return false;
+	}
+
+	positionQuantum = header.positionQuantum;
+	quaternionBits = header.quaternionBits;
+	this->prefetchBlocks = std::max(prefetchBlocks, 0);
+
+	// The writer did not get to close the recording - its complete blocks are still readable
+	if (!readIndex()) scanBlocks();
+
+	numFrames = blocks.empty() ? 0ull : blocks.back().firstFrame + blocks.back().numFrames;
+	file.prefetch(0, blocks.empty() ? 0 : size_t(blocks[std::min(blocks.size(), size_t(this->prefetchBlocks) + 1) - 1].offset));
+
+	return true;
+}
+
+/** @brief Unmaps the recording
+*/
+void TrajectoryReader::close(void)
+{
+	file.close();
+	blocks.clear();
+	numFrames = 0ull;
+	blockStarted = false;
+}
+
+/**
+* @brief Decodes the given frame. A frame behind the last one read from the same block continues from there, any other frame is
+* decoded from the key frame of its block. Returns false if the frame does not exist or its block is corrupted
+*/
+bool TrajectoryReader::readFrame(unsigned long long frame, TrajectoryPoses & poses)
+{
+	if (frame >= numFrames) return false;
+
+	// Last block which starts at or before the frame
+	size_t block = size_t(std::upper_bound(blocks.begin(), blocks.end(), frame, [](unsigned long long f, TrajectoryBlock const & entry) {
+		return f < entry.firstFrame;
+	}) - blocks.begin()) - 1;
+
+	if (!blockStarted || block != currentBlock || frame < nextFrame) {
+		if (!startBlock(block)) return false;
+	}
+
+	// The frames in between only update the prediction
+	while (nextFrame < frame) {
+		if (!decodeFrame(NULL)) return false;
+	}
+
+	return decodeFrame(&poses);
+}
+
+/** @brief Tells whether a recording is open
+*/
+bool TrajectoryReader::isOpen(void) const
+{
+	return file.data() != NULL;
+}
+
+/** @brief Returns the number of frames of the recording
+*/
+unsigned long long TrajectoryReader::getNumFrames(void) const
+{
+	return numFrames;
+}
+
+/** @brief Returns the block index, e.g. to seek by time with the time of the first frame of each block
+*/
+std::vector<TrajectoryBlock> const & TrajectoryReader::getBlocks(void) const
+{
+	return blocks;
+}
+
+/**
+* @brief Reads the block index at the end of a closed recording. Returns false if there is none or it does not fit the file
+*/
+bool TrajectoryReader::readIndex(void)
+{
+	size_t size = file.size();
+	unsigned char const * data = file.data();
+
+	TrajectoryFooter footer;
+	if (size < sizeof(TrajectoryFileHeader) + sizeof(footer)) return false;
+	std::memcpy(&footer, data + size - sizeof(footer), sizeof(footer));
+
+	if (std::memcmp(footer.magic, TRAJECTORY_INDEX_MAGIC, sizeof(footer.magic)) != 0) return false;
+	if (footer.indexOffset > size - sizeof(footer) || footer.numBlocks != (size - sizeof(footer) - footer.indexOffset) / sizeof(TrajectoryBlock)) return false;
+	if (footer.indexOffset + footer.numBlocks * sizeof(TrajectoryBlock) + sizeof(footer) != size) return false;
+
+	blocks.resize(size_t(footer.numBlocks));
+	if (!blocks.empty()) std::memcpy(blocks.data(), data + footer.indexOffset, blocks.size() * sizeof(TrajectoryBlock));
+
+	// Blocks have to lie in front of the index and follow each other frame by frame
+	unsigned long long frame = 0ull;
+	for (size_t block = 0; block < blocks.size(); block++) {
+		TrajectoryBlock const & entry = blocks[block];
+		bool valid = entry.firstFrame == frame && entry.numFrames > 0u && entry.offset >= sizeof(TrajectoryFileHeader)
+			&& entry.offset <= footer.indexOffset && footer.indexOffset - entry.offset >= sizeof(TrajectoryBlockHeader) + entry.bytes;
+		if (!valid) {
+			blocks.clear();
+			return false;
+		}
+		frame += entry.numFrames;
+	}
+
+	return frame == footer.numFrames;
+}
+
+/**
+* @brief Rebuilds the block index from the block headers, up to the first incomplete block
+*/
+void TrajectoryReader::scanBlocks(void)
+{
+	size_t size = file.size();
+	unsigned char const * data = file.data();
+
+	blocks.clear();
+	size_t offset = sizeof(TrajectoryFileHeader);
+	unsigned long long frame = 0ull;
+
+	while (size - offset >= sizeof(TrajectoryBlockHeader)) {
+		TrajectoryBlockHeader header;
+		std::memcpy(&header, data + offset, sizeof(header));
+
+		bool valid = std::memcmp(header.magic, TRAJECTORY_BLOCK_MAGIC, sizeof(header.magic)) == 0 && header.firstFrame == frame
+			&& header.numFrames > 0u && size - offset - sizeof(header) >= header.bytes;
+		if (!valid) break;
+
+		TrajectoryBlock entry;
+		entry.offset = offset;
+		entry.firstFrame = header.firstFrame;
+		entry.numFrames = header.numFrames;
+		entry.bytes = header.bytes;
+		entry.firstTime = header.firstTime;
+		blocks.push_back(entry);
+
+		offset += sizeof(header) + header.bytes;
+		frame += header.numFrames;
+	}
+}
+
+/**
+* @brief Moves the decoder to the key frame of the block and prefetches the blocks behind it
+*/
+bool TrajectoryReader::startBlock(size_t block)
+{
+	TrajectoryBlock const & entry = blocks[block];
+
+	blockStarted = true;
+	currentBlock = block;
+	nextFrame = entry.firstFrame;
+	blockFrames = 0u;
+	cursor = size_t(entry.offset) + sizeof(TrajectoryBlockHeader);
+
+	TrajectoryBlockHeader header;
+	std::memcpy(&header, file.data() + entry.offset, sizeof(header));
+	blockLayout = header.layout;
+	blockEnd = cursor + entry.bytes;
+
+	size_t lastPrefetched = std::min(block + size_t(prefetchBlocks), blocks.size() - 1);
+	if (lastPrefetched > block) {
+		size_t begin = size_t(blocks[block + 1].offset);
+		file.prefetch(begin, size_t(blocks[lastPrefetched].offset) + sizeof(TrajectoryBlockHeader) + blocks[lastPrefetched].bytes - begin);
+	}
+
+	return true;
+}
+
+/**
+* @brief Decodes the next frame of the block in hand, the counterpart of TrajectoryWriter::encodeFrame()
+* @param poses	Receives the poses, NULL only updates the prediction
+*/
+bool TrajectoryReader::decodeFrame(TrajectoryPoses * poses)
+{
+	unsigned char const * data = file.data();
+
+	// Frame header
+	unsigned long long numBodies;
+	double time;
+	if (blockFrames == blocks[currentBlock].numFrames || !readVarint(data, cursor, blockEnd, numBodies)) return false;
+	if (numBodies > TRAJECTORY_MAX_BODIES || blockEnd - cursor < sizeof(time)) return false;
+	std::memcpy(&time, data + cursor, sizeof(time));
+	cursor += sizeof(time);
+
+	size_t count = size_t(numBodies);
+	quantized.resize(TRAJECTORY_STREAMS * count);
+
+	unsigned int lastBodies = blockFrames > 0u ? historyBodies[0] : 0u;
+	unsigned int secondLastBodies = blockFrames > 1u ? historyBodies[1] : 0u;
+	unsigned long long zeros = 0ull;
+
+	for (int stream = 0; stream < TRAJECTORY_STREAMS; stream++) {
+
+		bool linear = stream < 3;
+
+		for (size_t body = 0; body < count; body++) {
+
+			unsigned long long residual = 0ull;
+			if (zeros > 0ull) {
+				zeros--;
+			}
+			else {
+				if (!readVarint(data, cursor, blockEnd, residual)) return false;
+				if (residual == 0ull && !readVarint(data, cursor, blockEnd, zeros)) return false;
+			}
+
+			long long prediction = 0ll;
+			if (body < lastBodies) {
+				long long last = history[0][stream * size_t(lastBodies) + body];
+				prediction = linear && body < secondLastBodies ? 2 * last - history[1][stream * size_t(secondLastBodies) + body] : last;
+			}
+
+			quantized[stream * count + body] = prediction + unzigzag(residual);
+		}
+	}
+
+	// A run of zeros never reaches into the next frame
+	if (zeros > 0ull) return false;
+
+	if (poses != NULL) {
+		poses->time = time;
+		poses->numBodies = unsigned(count);
+		poses->layout = blockLayout;
+
+		for (int c = 0; c < 3; c++) {
+			poses->position[c].resize(count);
+			for (size_t body = 0; body < count; body++) poses->position[c][body] = float(double(quantized[c * count + body]) * positionQuantum);
+		}
+		for (int c = 0; c < 4; c++) poses->quaternion[c].resize(count);
+
+		for (size_t body = 0; body < count; body++) {
+			long long smallestThree[4];
+			float q[4];
+			for (int c = 0; c < 4; c++) smallestThree[c] = quantized[(3 + c) * count + body];
+
+			restoreQuaternion(smallestThree, quaternionBits, q);
+			for (int c = 0; c < 4; c++) poses->quaternion[c][body] = q[c];
+		}
+	}
+
+	history[1].swap(history[0]);
+	history[0].swap(quantized);
+	historyBodies[1] = historyBodies[0];
+	historyBodies[0] = unsigned(count);
+
+	nextFrame++;
+	blockFrames++;
+
+	return true;
+}
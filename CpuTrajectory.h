@@ -0,0 +1,172 @@
+#pragma once
+#include <condition_variable>
+#include <cstdio>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "CpuCheckpoint.h"
+
+// Version of the trajectory format - readers reject other versions
+const unsigned int TRAJECTORY_VERSION = 1;
+
+// Precision and block length of a recording
+struct TrajectoryOptions {
+	float positionQuantum = 1e-5f; // Meters per step of the quantized positions
+	int quaternionBits = 16; // Bits of each of the three smallest quaternion components, 2 to 24
+	int framesPerBlock = 64; // Frames of a block - a block starts with a key frame, so it decodes on its own
+	int maxPendingFrames = 8; // Frames the writer thread may lag behind, writeFrame() waits beyond that
+};
+
+// Poses of the bodies of one frame. Component c of body b is position[c][b * positionStride], the quaternion is stored in the layout
+// of the solver - the scalar part in x. The streams of the CPU solver have a stride of 1, the RGBA textures of the plugin one of 4
+struct TrajectoryFrame {
+	double time = 0.0; // Seconds of simulated time
+	unsigned int numBodies = 0u;
+	float const * position[3] = {};
+	float const * quaternion[4] = {};
+	int positionStride = 1;
+	int quaternionStride = 1;
+	unsigned int layout = 0u; // Changed by the caller whenever a body index is handed to another body, see TrajectoryWriter
+};
+
+// Poses of a decoded frame, the quaternion in the layout it was recorded in
+struct TrajectoryPoses {
+	double time = 0.0;
+	unsigned int numBodies = 0u;
+	unsigned int layout = 0u; // Frames with the same layout index the same bodies
+	std::vector<float> position[3];
+	std::vector<float> quaternion[4];
+};
+
+// Entry of the block index at the end of a recording
+struct TrajectoryBlock {
+	unsigned long long offset; // Of the block header
+	unsigned long long firstFrame;
+	unsigned int numFrames;
+	unsigned int bytes; // Encoded frames behind the header
+	double firstTime;
+};
+
+// Size of a recording so far
+struct TrajectoryStats {
+	unsigned long long frames = 0ull;
+	unsigned long long rawBytes = 0ull; // Seven floats per body and frame
+	unsigned long long fileBytes = 0ull; // Written to the file, the frames the writer thread still holds are missing
+};
+
+// Streams the body poses of a simulation into a compact file. Positions are quantized to positionQuantum, quaternions to their
+// three smallest components, which the unit length restores the largest from. Each value is predicted from the last frames of its
+// body - positions linearly from the last two, quaternions by the last one - and the residuals are stored as variable length
+// integers with runs of zeros collapsed, so resting bodies cost next to nothing. Frames are grouped into blocks which start with a
+// key frame and are indexed at the end of the file, so a reader can seek to any block. Encoding and writing run on a thread of
+// their own, writeFrame() only copies the poses into one of at most maxPendingFrames buffers.
+// Bodies are identified by their index only. Whenever an index goes to another body - a despawned body is recycled or the
+// bodies are compacted - the caller changes TrajectoryFrame::layout. A frame with another layout starts a new block, so the
+// prediction never mixes two bodies, and the block header keeps the layout for the reader
+class TrajectoryWriter
+{
+public:
+	TrajectoryWriter();
+	~TrajectoryWriter();
+
+	bool open(std::string const & path, TrajectoryOptions const & options = TrajectoryOptions());
+	bool writeFrame(TrajectoryFrame const & frame);
+	bool close(void);
+
+	bool isOpen(void) const;
+	TrajectoryStats getStats(void);
+
+private:
+
+	TrajectoryWriter(const TrajectoryWriter &);
+	TrajectoryWriter & operator=(const TrajectoryWriter &);
+
+	struct PendingFrame {
+		double time;
+		unsigned int numBodies;
+		unsigned int layout;
+		std::vector<float> poses; // Seven streams of numBodies values - x, y, z and the quaternion
+	};
+
+	void writerLoop(void);
+	void encodeFrame(PendingFrame const & frame);
+	void flushBlock(void);
+	bool writeBytes(void const * data, size_t bytes);
+
+	TrajectoryOptions options;
+	std::FILE * file = NULL;
+	std::thread writer;
+
+	// Handed between writeFrame() and the writer thread - guarded by mutex
+	std::mutex mutex;
+	std::condition_variable frameAvailable;
+	std::condition_variable bufferAvailable;
+	std::deque<PendingFrame> pending;
+	std::vector<std::vector<float> > spareBuffers;
+	TrajectoryStats stats;
+	bool closing = false;
+	bool failed = false;
+
+	// Encoder - only touched by the writer thread until close() joins it
+	std::vector<unsigned char> block;
+	std::vector<TrajectoryBlock> blocks;
+	unsigned long long numFrames = 0ull;
+	unsigned int blockFrames = 0u;
+	double blockTime = 0.0;
+	unsigned int blockLayout = 0u;
+	unsigned long long fileOffset = 0ull;
+	std::vector<long long> history[2]; // Quantized values of the last two frames of the block, the last one first
+	unsigned int historyBodies[2] = { 0u, 0u };
+	std::vector<long long> quantized;
+
+};
+
+// Plays back a recording of TrajectoryWriter. The file is mapped and a frame is found through the block index - rebuilt from the
+// block headers if the recording was not closed - and decoded from the key frame of its block. Reading on from the last frame
+// continues the block in hand and prefetches the next blocks, so playing a recording streams it from the disk
+class TrajectoryReader
+{
+public:
+	TrajectoryReader();
+	~TrajectoryReader();
+
+	bool open(std::string const & path, int prefetchBlocks = 4);
+	void close(void);
+	bool readFrame(unsigned long long frame, TrajectoryPoses & poses);
+
+	bool isOpen(void) const;
+	unsigned long long getNumFrames(void) const;
+	std::vector<TrajectoryBlock> const & getBlocks(void) const;
+
+private:
+
+	TrajectoryReader(const TrajectoryReader &);
+	TrajectoryReader & operator=(const TrajectoryReader &);
+
+	bool readIndex(void);
+	void scanBlocks(void);
+	bool startBlock(size_t block);
+	bool decodeFrame(TrajectoryPoses * poses);
+
+	MappedFile file;
+	float positionQuantum = 1e-5f;
+	int quaternionBits = 16;
+	int prefetchBlocks = 4;
+	std::vector<TrajectoryBlock> blocks;
+	unsigned long long numFrames = 0ull;
+
+	// Decoder - the frame it decodes next and the last two frames of the block
+	bool blockStarted = false;
+	size_t currentBlock = 0;
+	unsigned long long nextFrame = 0ull;
+	unsigned int blockFrames = 0u;
+	unsigned int blockLayout = 0u;
+	size_t cursor = 0; // Offset of the next frame in the mapping
+	size_t blockEnd = 0;
+	std::vector<long long> history[2];
+	unsigned int historyBodies[2] = { 0u, 0u };
+	std::vector<long long> quantized;
+
+};
@@ -10,6 +10,7 @@
 #include "glm/ext.hpp"
 #include "OBJ_Loader.h"
 #include <iosfwd>
+#include <cmath>
 #include "lodepng.h"
 #include "soil.h"
 #include <windows.h>
@@ -166,6 +167,47 @@ bool RigidSolver::Activate(void) {
 	spawnTime.SetMinMax(1.0, 300.0);
 	spawnTime = 1;
 
+	// Fixed time step - each frame runs as many steps as fit into the elapsed time, at most MaxSubsteps
+	timeStep.Set(this, "TimeStep(ms)");
+	timeStep.Register();
+	timeStep.SetMinMax(0.1, 100.0);
+	timeStep = 1000.f / 120.f;
+
+	maxSubsteps.Set(this, "MaxSubsteps");
+	maxSubsteps.Register();
+	maxSubsteps.SetMinMax(1.0, 64.0);
+	maxSubsteps = 8;
+
+	// Offline batches - MaxSubsteps steps per frame regardless of the wall clock
+	asFastAsPossible.Set(this, "AsFastAsPossible");
+	asFastAsPossible.Register();
+	asFastAsPossible = false;
+
+	// Pre-warm - runs FastForwardSteps steps in one frame without drawing them, e.g. to settle a pile
+	fastForwardSteps.Set(this, "FastForwardSteps");
+	fastForwardSteps.Register();
+	fastForwardSteps.SetMinMax(1.0, 100000.0);
+	fastForwardSteps = 1200;
+
+	fastForwardButton.Set(this, "FastForward", &RigidSolver::fastForwardTriggered);
+	fastForwardButton.Register();
+
+	// Archive - the poses of every step go to a compressed trajectory next to the plugin
+	trajectoryPath = pathName + std::string("/trajectory.trj");
+	recordTrajectory.Set(this, "RecordTrajectory", &RigidSolver::recordTrajectoryChanged);
+	recordTrajectory.Register();
+	recordTrajectory = false;
+
+	// Review - draws the recording instead of simulating, ReplayFrame seeks in it
+	replayTrajectory.Set(this, "ReplayTrajectory", &RigidSolver::replayTrajectoryChanged);
+	replayTrajectory.Register();
+	replayTrajectory = false;
+
+	replayFrame.Set(this, "ReplayFrame");
+	replayFrame.Register();
+	replayFrame.SetMinMax(0.0, 0.0);
+	replayFrame = 0;
+
 	gravity.Set(this, "Gravity");
 	gravity.Register();
 	gravity = 9.807f; // m/s^2
@@ -264,6 +306,10 @@ bool RigidSolver::Activate(void) {
 }
 
 bool RigidSolver::Deactivate(void) {
+	// Writes the last block and the index of the recording
+	trajectory.close();
+	replay.close();
+
 	// Detach Shaders
 	shaderBeauty.RemoveAllShaders();
 	shaderMomentaCalculation.RemoveAllShaders();
@@ -317,7 +363,7 @@ bool RigidSolver::Init(void) {
 
 bool RigidSolver::Idle(void)
 {
-	if (solverStatus && modelFiles.GetValue() != NULL) PostRedisplay();
+	if ((solverStatus || replay.isOpen()) && modelFiles.GetValue() != NULL) PostRedisplay();
 	return true;
 }
 
@@ -327,22 +373,43 @@ bool RigidSolver::Render(void) {
 	//  Setup
 	// --------------------------------------------------  
 
-	// Switching the texture switch to use it the other way around
-	// The one that is active (false=1, true=2) means that it is read from
-	if (texSwitch == false) texSwitch = true;
-	else texSwitch = false;
+	int substeps = 0;
+
+	// A replay draws the recorded poses, none of the passes of the solver run
+	if (replay.isOpen()) {
+		time = std::chrono::high_resolution_clock::now();
+		timeSpanRender = std::min(std::chrono::duration<double, std::milli>(time - lastRender), std::chrono::duration<double, std::milli>(416));
+		lastRender = time;
+		fastForwardPending = false;
+
+		if (int(replayFrame) != lastReplayFrame) seekReplay(replayFrame);
+		else if (solverStatus) playReplay(timeSpanRender.count() / 1000.0);
+
+		beautyPass();
+		return false;
+	}
+
+	// The fast forward runs before the wall clock of this frame is taken, so its duration does not count as lag
+	if (fastForwardPending && modelFiles.GetValue() != NULL && vaModel.getNumParticles() > 0) fastForward(fastForwardSteps);
+	fastForwardPending = false;
 
 	if (solverStatus && modelFiles.GetValue() != NULL) {
-		// Get current time and eventually spawn a new particle
+		// Get current time and determine the number of fixed steps of this frame
 		time = std::chrono::high_resolution_clock::now();
 		timeSpanRender = std::min(std::chrono::duration<double, std::milli>(time - lastRender), std::chrono::duration<double, std::milli>(416));
-		timeSpanSpawn = time - lastSpawn;
-		if (timeSpanSpawn.count() / 1000.f  >= spawnTime && spawnedObjects <= numRigidBodies) {
-			spawnedObjects = std::min((int)(spawnedObjects + 1), MAX_NUMBER_OF_RIGID_BODIES);
-			lastSpawn = time;
-		}
 		lastRender = time;
-		
+
+		if (asFastAsPossible) {
+			substeps = maxSubsteps;
+		}
+		else {
+			accumulatedTime += timeSpanRender.count();
+			substeps = std::min(int(accumulatedTime / timeStep), int(maxSubsteps));
+			accumulatedTime -= substeps * double(timeStep);
+
+			// Time which could not be caught up is dropped, otherwise every frame would fall further behind
+			if (accumulatedTime >= timeStep) accumulatedTime = std::fmod(accumulatedTime, double(timeStep));
+		}
 	}
 
 	// --------------------------------------------------
@@ -353,20 +420,7 @@ bool RigidSolver::Render(void) {
 
 		glDisable(GL_DITHER);
 
-		// Physical values - Determine rigid positions and particle attributes
-		particleValuePass();
-
-		// Generate Lookup grid - Assign the particles to the voxels
-		collisionGridPass();
-
-		// Collision - Find collision and calculate forces
- 		collisionPass();
-
-		// Particle positions - Determine the momenta and quaternions
-		momentaPass();
-
-		// Calculate the new rigid body positions
-		solverPass();
+		for (int substep = 0; substep < substeps; substep++) solverStep();
 
 		glEnable(GL_DITHER);
 
@@ -376,7 +430,7 @@ bool RigidSolver::Render(void) {
 	//  Rendering
 	// --------------------------------------------------  
 
-	// Render beauty
+	// Render beauty - only the state of the last substep is drawn
 	beautyPass();
 
     return false;
@@ -591,7 +645,7 @@ bool RigidSolver::particleValuePass(void)
 	
 	glUniform1f(shaderParticleValues.GetUniformLocation("mass"), modelMass);
 	glUniform1f(shaderParticleValues.GetUniformLocation("gravity"), gravity);
-	glUniform1f(shaderParticleValues.GetUniformLocation("deltaT"), timeSpanRender.count() / 1000.f);
+	glUniform1f(shaderParticleValues.GetUniformLocation("deltaT"), timeStep / 1000.f);
 
 	vaVertex.Bind();
 	drawAbstractData(sideLength, sideLength, shaderParticleValues, true);
@@ -601,7 +655,7 @@ bool RigidSolver::particleValuePass(void)
 
 	glBindFramebuffer(GL_FRAMEBUFFER, 0);
 
-	if (DEBUGGING) {
+	if (DEBUGGING && !fastForwarding) {
 
 		int particleSideLength = getParticleTextureSideLength();
 
@@ -754,7 +808,7 @@ bool RigidSolver::collisionGridPass(void)
 	glClearColor(bkColor[0], bkColor[1], bkColor[2], bkColor[3]);
 	glBindFramebuffer(GL_FRAMEBUFFER, 0);
 
-	if (DEBUGGING) {
+	if (DEBUGGING && !fastForwarding) {
 		GLuint * gridIndices;
 
 		glm::ivec3 gridResolution = grid.getGridResolution();
@@ -814,7 +868,7 @@ bool RigidSolver::collisionPass() {
 	// Uniforms
 	glUniform1f(shaderCollision.GetUniformLocation("gravity"), gravity);
 	glUniform1f(shaderCollision.GetUniformLocation("mass"), modelMass);
-	glUniform1f(shaderCollision.GetUniformLocation("deltaT"), timeSpanRender.count() / 1000.f);
+	glUniform1f(shaderCollision.GetUniformLocation("deltaT"), timeStep / 1000.f);
 	glUniform1f(shaderCollision.GetUniformLocation("voxelLength"), grid.getVoxelLength());
 	glUniform1f(shaderCollision.GetUniformLocation("particleDiameter"), particleSize);
 	glUniform1f(shaderCollision.GetUniformLocation("dampingCoefficient"), dampingCoefficient);
@@ -843,7 +897,7 @@ bool RigidSolver::collisionPass() {
 
 	glBindFramebuffer(GL_FRAMEBUFFER, 0);
 
-	if (DEBUGGING) {
+	if (DEBUGGING && !fastForwarding) {
 
 		int particleSideLength = getParticleTextureSideLength();
 
@@ -884,7 +938,7 @@ bool RigidSolver::momentaPass(void)
 	glUniform1i(shaderMomentaCalculation.GetUniformLocation("particlesPerModel"), vaModel.getNumParticles());
 	glUniform1i(shaderMomentaCalculation.GetUniformLocation("spawnedObjects"), spawnedObjects);
 	
-	glUniform1f(shaderMomentaCalculation.GetUniformLocation("deltaT"), timeSpanRender.count() / 1000.f);
+	glUniform1f(shaderMomentaCalculation.GetUniformLocation("deltaT"), timeStep / 1000.f);
 
 	// Activate the input textures
 	glActiveTexture(GL_TEXTURE0);
@@ -905,7 +959,7 @@ bool RigidSolver::momentaPass(void)
 	glBindFramebuffer(GL_FRAMEBUFFER, 0);
 
 
-	if (DEBUGGING) {
+	if (DEBUGGING && !fastForwarding) {
 
 		int size = rigidBodyTextureLength * rigidBodyTextureLength * 3;
 
@@ -987,7 +1041,7 @@ bool RigidSolver::solverPass(void)
 	glUniform1i(shaderSolver.GetUniformLocation("spawnedObjects"), spawnedObjects);
 
 	glUniform1f(shaderSolver.GetUniformLocation("mass"), modelMass);
-	glUniform1f(shaderSolver.GetUniformLocation("deltaT"), timeSpanRender.count() / 1000.f); // FIXME: Is this really right?
+	glUniform1f(shaderSolver.GetUniformLocation("deltaT"), timeStep / 1000.f);
 
 	glUniformMatrix3fv(shaderSolver.GetUniformLocation("invInertiaTensor"), 1, false, glm::value_ptr(glm::inverse(vaModel.getInertiaTensor())));
 
@@ -1009,7 +1063,7 @@ bool RigidSolver::solverPass(void)
 	glBindFramebuffer(GL_FRAMEBUFFER, 0);
 
 
-	if (DEBUGGING) {
+	if (DEBUGGING && !fastForwarding) {
 
 		int size = rigidBodyTextureLength * rigidBodyTextureLength;
 
@@ -1229,8 +1283,19 @@ bool RigidSolver::resetSimulation(void)
 	initSolverFBOs();
 
 	time = std::chrono::high_resolution_clock::now();
-	lastSpawn = time;
 	lastRender = time;
+	accumulatedTime = 0.0;
+	timeSinceSpawn = 0.f;
+	simulatedTime = 0.0;
+
+	// A reset starts a new recording
+	if (trajectory.isOpen()) {
+		trajectory.close();
+		trajectory.open(trajectoryPath);
+	}
+
+	// The textures were cleared - a replay uploads its frame again
+	lastReplayFrame = -1;
 
 	return true;
 }
@@ -1241,8 +1306,8 @@ bool RigidSolver::resetSimulation(void)
 bool RigidSolver::stopSimulation(void)
 {
 	time = std::chrono::high_resolution_clock::now();
-	lastSpawn = time;
 	lastRender = time;
+	accumulatedTime = 0.0;
 
 	solverStatus = false;
 	return true;
@@ -1257,6 +1322,188 @@ bool RigidSolver::continueSimulation(void)
 	return true;
 }
 
+/**
+* @brief Runs the passes of one fixed step of timeStep milliseconds
+*/
+bool RigidSolver::solverStep(void)
+{
+	// Spawning is driven by simulated time so it does not depend on the frame rate
+	timeSinceSpawn += timeStep / 1000.f;
+	if (timeSinceSpawn >= spawnTime && spawnedObjects <= numRigidBodies) {
+		spawnedObjects = std::min((int)(spawnedObjects + 1), MAX_NUMBER_OF_RIGID_BODIES);
+		timeSinceSpawn = 0.f;
+	}
+
+	// Switching the texture switch to use it the other way around
+	// The one that is active (false=1, true=2) means that it is read from
+	if (texSwitch == false) texSwitch = true;
+	else texSwitch = false;
+
+	// Physical values - Determine rigid positions and particle attributes
+	particleValuePass();
+
+	// Generate Lookup grid - Assign the particles to the voxels
+	collisionGridPass();
+
+	// Collision - Find collision and calculate forces
+	collisionPass();
+
+	// Particle positions - Determine the momenta and quaternions
+	momentaPass();
+
+	// Calculate the new rigid body positions
+	solverPass();
+
+	simulatedTime += timeStep / 1000.0;
+	if (trajectory.isOpen()) recordTrajectoryFrame();
+
+	return true;
+}
+
+/**
+* @brief Reads the rigid body positions and quaternions written by the last solver pass back and hands them to the recording. The
+* writer thread of the recording compresses and writes them, only the read back stalls the passes
+*/
+bool RigidSolver::recordTrajectoryFrame(void)
+{
+	int rigidBodyTextureLength = getRigidBodyTextureSizeLength();
+	int size = rigidBodyTextureLength * rigidBodyTextureLength;
+
+	trajectoryPositions.resize(size * 4);
+	trajectoryQuaternions.resize(size * 4);
+
+	// The solver pass wrote the textures which are not read from
+	if (texSwitch == false) glBindTexture(GL_TEXTURE_2D, rigidBodyPositionsTex2);
+	else glBindTexture(GL_TEXTURE_2D, rigidBodyPositionsTex1);
+	glGetTexImage(GL_TEXTURE_2D, 0, GL_RGBA, GL_FLOAT, trajectoryPositions.data());
+
+	if (texSwitch == false) glBindTexture(GL_TEXTURE_2D, rigidBodyQuaternionsTex2);
+	else glBindTexture(GL_TEXTURE_2D, rigidBodyQuaternionsTex1);
+	glGetTexImage(GL_TEXTURE_2D, 0, GL_RGBA, GL_FLOAT, trajectoryQuaternions.data());
+
+	glBindTexture(GL_TEXTURE_2D, 0);
+
+	TrajectoryFrame frame;
+	frame.time = simulatedTime;
+	frame.numBodies = std::min(spawnedObjects, unsigned(size));
+	for (int c = 0; c < 3; c++) frame.position[c] = trajectoryPositions.data() + c;
+	for (int c = 0; c < 4; c++) frame.quaternion[c] = trajectoryQuaternions.data() + c;
+	frame.positionStride = 4;
+	frame.quaternionStride = 4;
+
+	return trajectory.writeFrame(frame);
+}
+
+/**
+* @brief Shows the given frame of the replay. The reader decodes it from the key frame of its block, the frame after it is decoded
+* right away so playing on continues the block
+*/
+bool RigidSolver::seekReplay(int frame)
+{
+	frame = std::max(0, std::min(frame, int(replay.getNumFrames()) - 1));
+
+	if (!replay.readFrame((unsigned long long)frame, replayPoses)) {
+		std::cout << "Could not read frame " << frame << " of " << trajectoryPath << std::endl;
+		replayFrame = frame;
+		lastReplayFrame = frame;
+		return false;
+	}
+	replayNextLoaded = replay.readFrame((unsigned long long)frame + 1, replayNextPoses);
+	replayTime = replayPoses.time;
+
+	replayFrame = frame;
+	lastReplayFrame = frame;
+	return uploadReplayPoses();
+}
+
+/**
+* @brief Plays the replay on by seconds of recorded time. Frames which are due are decoded in order, only the last one is uploaded.
+* The replay stops at the last frame
+*/
+bool RigidSolver::playReplay(double seconds)
+{
+	replayTime += seconds;
+
+	int frame = lastReplayFrame;
+	while (replayNextLoaded && replayNextPoses.time <= replayTime) {
+		std::swap(replayPoses, replayNextPoses);
+		frame++;
+		replayNextLoaded = replay.readFrame((unsigned long long)frame + 1, replayNextPoses);
+	}
+
+	if (frame == lastReplayFrame) return true;
+
+	replayFrame = frame;
+	lastReplayFrame = frame;
+	return uploadReplayPoses();
+}
+
+/**
+* @brief Writes the poses of the replay into the rigid body textures the beauty pass reads. Bodies beyond the textures are dropped
+*/
+bool RigidSolver::uploadReplayPoses(void)
+{
+	int rigidBodyTextureLength = getRigidBodyTextureSizeLength();
+	int size = rigidBodyTextureLength * rigidBodyTextureLength;
+	unsigned int numBodies = std::min(replayPoses.numBodies, unsigned(size));
+
+	replayPositions.assign(size * 4, 0.f);
+	replayQuaternions.assign(size * 4, 0.f);
+
+	for (unsigned int body = 0; body < numBodies; body++) {
+		for (int c = 0; c < 3; c++) replayPositions[body * 4 + c] = replayPoses.position[c][body];
+		replayPositions[body * 4 + 3] = 1.f;
+		for (int c = 0; c < 4; c++) replayQuaternions[body * 4 + c] = replayPoses.quaternion[c][body];
+	}
+
+	if (texSwitch == false) glBindTexture(GL_TEXTURE_2D, rigidBodyPositionsTex1);
+	else glBindTexture(GL_TEXTURE_2D, rigidBodyPositionsTex2);
+	glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, rigidBodyTextureLength, rigidBodyTextureLength, GL_RGBA, GL_FLOAT, replayPositions.data());
+
+	if (texSwitch == false) glBindTexture(GL_TEXTURE_2D, rigidBodyQuaternionsTex1);
+	else glBindTexture(GL_TEXTURE_2D, rigidBodyQuaternionsTex2);
+	glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, rigidBodyTextureLength, rigidBodyTextureLength, GL_RGBA, GL_FLOAT, replayQuaternions.data());
+
+	glBindTexture(GL_TEXTURE_2D, 0);
+
+	spawnedObjects = numBodies;
+	return true;
+}
+
+/**
+* @brief Runs numSteps steps back to back, e.g. to settle a pile before an experiment. Neither the beauty pass nor the debug output
+* of the passes run in between and there is no wall clock or substep limit. The progress goes to stderr every tenth of the steps
+*/
+bool RigidSolver::fastForward(int numSteps)
+{
+	std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+	int reportInterval = std::max(numSteps / 10, 1);
+
+	fastForwarding = true;
+	glDisable(GL_DITHER);
+
+	for (int step = 0; step < numSteps; step++) {
+		solverStep();
+
+		if ((step + 1) % reportInterval == 0 || step + 1 == numSteps) {
+			// The passes are queued - the time is only meaningful once they ran
+			glFinish();
+			fprintf(stderr, "Fast forward: %d / %d steps, %.2f s simulated in %.2f s\n", step + 1, numSteps, (step + 1) * timeStep / 1000.f,
+				std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count());
+		}
+	}
+
+	glEnable(GL_DITHER);
+	fastForwarding = false;
+
+	// The simulation goes on from here in real time
+	time = std::chrono::high_resolution_clock::now();
+	lastRender = time;
+	accumulatedTime = 0.0;
+
+	return true;
+}
+
 /**
 * @brief Convenience function which encapsulates all the shader initializations
 */
@@ -1362,7 +1609,8 @@ bool RigidSolver::updateGrid() {
 	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
 
 	// Creating grid - specifing with the minium size of (16, 256, 256): Overhead is just not used
-	glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_RGBA16UI, std::max(gridDimensions.x, 16), std::max(gridDimensions.y, 256), std::max(gridDimensions.z, 256), 0, GL_RGBA_INTEGER, GL_UNSIGNED_INT, nullptr);
+	// 32 bit particle ids - 16 bit ids wrapped silently beyond 65535 particles
+	glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_RGBA32UI, std::max(gridDimensions.x, 16), std::max(gridDimensions.y, 256), std::max(gridDimensions.z, 256), 0, GL_RGBA_INTEGER, GL_UNSIGNED_INT, nullptr);
 	
 	glFramebufferTexture(GL_FRAMEBUFFER, GridIndiceAttachment, gridTex, 0);
 
@@ -1549,6 +1797,50 @@ void RigidSolver::resetSimulationTriggered(ButtonVar<RigidSolver> &button) {
 	resetSimulation();
 }
 
+void RigidSolver::fastForwardTriggered(ButtonVar<RigidSolver> &button) {
+
+	fastForwardPending = true;
+}
+
+void RigidSolver::recordTrajectoryChanged(APIVar<RigidSolver, BoolVarPolicy> &var) {
+
+	if (var.GetValue() && !trajectory.isOpen()) {
+		if (!trajectory.open(trajectoryPath)) std::cout << "Could not create " << trajectoryPath << std::endl;
+	}
+	else if (!var.GetValue() && trajectory.isOpen()) {
+		TrajectoryStats stats = trajectory.getStats();
+		if (trajectory.close()) std::cout << "Recorded " << stats.frames << " frames to " << trajectoryPath << std::endl;
+		else std::cout << "Could not write " << trajectoryPath << std::endl;
+	}
+}
+
+void RigidSolver::replayTrajectoryChanged(APIVar<RigidSolver, BoolVarPolicy> &var) {
+
+	if (var.GetValue() && !replay.isOpen()) {
+		// The recording is finished before it is read
+		if (trajectory.isOpen()) {
+			trajectory.close();
+			recordTrajectory = false;
+		}
+
+		if (!replay.open(trajectoryPath) || replay.getNumFrames() == 0) {
+			std::cout << "Could not replay " << trajectoryPath << std::endl;
+			replay.close();
+			return;
+		}
+
+		std::cout << "Replaying " << replay.getNumFrames() << " frames of " << trajectoryPath << std::endl;
+		replayFrame.SetMinMax(0.0, double(replay.getNumFrames() - 1));
+		replayFrame = 0;
+		lastReplayFrame = -1;
+	}
+	else if (!var.GetValue() && replay.isOpen()) {
+		// The simulation starts over, the textures hold recorded poses
+		replay.close();
+		resetSimulation();
+	}
+}
+
 // --------------------------------------------------
 //  HELPERS
 // --------------------------------------------------   
@@ -6,6 +6,7 @@
 #include "glm/glm.hpp"
 #include "VertexArray.h"
 #include "SolverModel.h"
+#include "CpuTrajectory.h"
 
 // Global variables
 const bool DEBUGGING = true;
@@ -48,6 +49,12 @@ private:
 	virtual bool resetSimulation(void);
 	virtual bool stopSimulation(void);
 	virtual bool continueSimulation(void);
+	virtual bool solverStep(void);
+	virtual bool fastForward(int numSteps);
+	virtual bool recordTrajectoryFrame(void);
+	virtual bool seekReplay(int frame);
+	virtual bool playReplay(double seconds);
+	virtual bool uploadReplayPoses(void);
 
 	virtual bool reloadShaders(void);
 
@@ -73,6 +80,9 @@ private:
 	void fileChanged(FileEnumVar<RigidSolver> &var);
 	void particleSizeChanged(APIVar<RigidSolver, FloatVarPolicy> &var);
 	void resetSimulationTriggered(ButtonVar<RigidSolver> &button);
+	void fastForwardTriggered(ButtonVar<RigidSolver> &button);
+	void recordTrajectoryChanged(APIVar<RigidSolver, BoolVarPolicy> &var);
+	void replayTrajectoryChanged(APIVar<RigidSolver, BoolVarPolicy> &var);
 
 	// API Vars
 	FileEnumVar<RigidSolver>  modelFiles;
@@ -86,7 +96,15 @@ private:
 	APIVar<RigidSolver, FloatVarPolicy> springCoefficient;
 	APIVar<RigidSolver, FloatVarPolicy> dampingCoefficient;
 	APIVar<RigidSolver, IntVarPolicy> spawnTime;
+	APIVar<RigidSolver, FloatVarPolicy> timeStep;
+	APIVar<RigidSolver, IntVarPolicy> maxSubsteps;
+	APIVar<RigidSolver, BoolVarPolicy> asFastAsPossible;
 	ButtonVar<RigidSolver> resetButton;
+	APIVar<RigidSolver, IntVarPolicy> fastForwardSteps;
+	ButtonVar<RigidSolver> fastForwardButton;
+	APIVar<RigidSolver, BoolVarPolicy> recordTrajectory;
+	APIVar<RigidSolver, BoolVarPolicy> replayTrajectory;
+	APIVar<RigidSolver, IntVarPolicy> replayFrame;
 
 
 	// Paths - needed for reloadShaders()
@@ -105,8 +123,26 @@ private:
 
 	// Solver
 	unsigned int spawnedObjects = 1u; // Always starts with one instance
-	std::chrono::high_resolution_clock::time_point time = std::chrono::high_resolution_clock::now(), lastSpawn = time, lastRender = time;
-	std::chrono::duration<double, std::milli> timeSpanRender, timeSpanSpawn;
+	std::chrono::high_resolution_clock::time_point time = std::chrono::high_resolution_clock::now(), lastRender = time;
+	std::chrono::duration<double, std::milli> timeSpanRender;
+	double accumulatedTime = 0.0; // Milliseconds of wall clock time which are not simulated yet
+	float timeSinceSpawn = 0.f; // Seconds of simulated time since the last spawn
+	bool fastForwardPending = false; // The next frame fast forwards before it is drawn
+	bool fastForwarding = false; // Suppresses the debug output of the passes
+	double simulatedTime = 0.0; // Seconds of simulated time since the reset
+
+	// Recording of the body poses of every step
+	TrajectoryWriter trajectory;
+	std::string trajectoryPath;
+	std::vector<float> trajectoryPositions, trajectoryQuaternions; // Read back from the rigid body textures
+
+	// Replay of a recording instead of the passes
+	TrajectoryReader replay;
+	TrajectoryPoses replayPoses, replayNextPoses; // The frame on screen and the one after it
+	bool replayNextLoaded = false;
+	int lastReplayFrame = -1; // Frame on screen, ReplayFrame differs from it after a seek
+	double replayTime = 0.0; // Seconds of recorded time on screen
+	std::vector<float> replayPositions, replayQuaternions; // Uploaded to the rigid body textures
 
 	// --------------------------------------------------
 	//  OpenGL variables